@@ -0,0 +1,175 @@
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Jeremy Salwen nor the name of any other
+//    contributor may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/*
+ * Microbenchmark comparing the context accumulation kernels against the
+ * original std::transform implementation of compute_context.
+ */
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+#include <boost/program_options.hpp>
+
+#include "contextkernels.hpp"
+
+namespace po=boost::program_options;
+
+//The implementation of compute_context before the kernels, on a plain column-major matrix
+static void legacy_compute_context(const int* context, const std::vector<float>& idfs, const std::vector<float>& origvects, float* outvec, unsigned int vecdim, unsigned int contextsize) {
+	float idfc[2*contextsize+1]; //idf context window
+
+	//Look up the idfs of the words in context
+	std::transform(context,context+2*contextsize+1,idfc,[&idfs](int c) ->float {return idfs[c];});
+
+	float idfsum=std::accumulate(idfc,&idfc[contextsize],0.0f)+std::accumulate(&idfc[contextsize+1],&idfc[2*contextsize+1],0.0f);
+	if(idfsum==0) {
+		return;
+	}
+	float invidfsum=1/idfsum; 
+
+	for(unsigned int i=0; i<2*contextsize+1; i++) {
+		if(i==contextsize) continue;
+		float idfterm=idfc[i]*invidfsum;
+		const float* col=&origvects[(size_t)context[i]*vecdim];
+		std::transform(outvec, outvec+vecdim, col, outvec,  [idfterm](float f1, float f2) -> float { return f1+f2*idfterm; });
+	}
+}
+
+static void kernel_compute_context(const ContextKernels& kernels, const int* context, const std::vector<float>& idfs, const std::vector<float>& origvects, float* outvec, unsigned int vecdim, unsigned int contextsize, std::vector<const float*>& cols, std::vector<float>& weights) {
+  float idfsum=0;
+  for(unsigned int i=0; i<2*contextsize+1; i++) {
+    if(i!=contextsize) idfsum+=idfs[context[i]];
+  }
+  if(idfsum==0) {
+    return;
+  }
+  float invidfsum=1/idfsum;
+  unsigned int n=0;
+  for(unsigned int i=0; i<2*contextsize+1; i++) {
+    if(i==contextsize) continue;
+    cols[n]=&origvects[(size_t)context[i]*vecdim];
+    weights[n]=idfs[context[i]]*invidfsum;
+    n++;
+  }
+  kernels.weighted_sum(cols.data(), weights.data(), n, outvec, vecdim);
+}
+
+template<typename F>
+static double time_per_context(F f, size_t numcontexts, unsigned int repeats) {
+  auto start=std::chrono::steady_clock::now();
+  for(unsigned int r=0; r<repeats; r++) {
+    for(size_t i=0; i<numcontexts; i++) {
+      f(i);
+    }
+  }
+  std::chrono::duration<double, std::nano> elapsed=std::chrono::steady_clock::now()-start;
+  return elapsed.count()/(numcontexts*(double)repeats);
+}
+
+int main(int argc, char** argv) {
+  unsigned int vocabsize;
+  unsigned int contextsize;
+  size_t numcontexts;
+  unsigned int repeats;
+  std::vector<unsigned int> dims;
+
+  po::options_description desc("CBenchContexts Options");
+  desc.add_options()
+    ("help,h", "produce help message")
+    ("vocabsize,v", po::value<unsigned int>(&vocabsize)->value_name("<number>")->default_value(100000), "number of random word vectors")
+    ("contextsize,s", po::value<unsigned int>(&contextsize)->value_name("<number>")->default_value(5),"size of context (# of words before and after)")
+    ("contexts,n", po::value<size_t>(&numcontexts)->value_name("<number>")->default_value(100000), "number of contexts per run")
+    ("repeats,r", po::value<unsigned int>(&repeats)->value_name("<number>")->default_value(10), "number of runs")
+    ("dim,d", po::value<std::vector<unsigned int> >(&dims)->value_name("<number>")->multitoken(), "word vector dimensions to test (default 50 100 200 300 64)")
+    ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  if (vm.count("help")) {
+    std::cout << desc << "\n";
+    return 0;
+  }
+  po::notify(vm);
+  if(dims.empty()) {
+    dims={50, 100, 200, 300, 64};
+  }
+
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> uniform(0,1);
+  std::normal_distribution<float> normal(0,1);
+  std::uniform_int_distribution<int> word(0, vocabsize-1);
+
+  std::vector<float> idfs(vocabsize);
+  for(float& f: idfs) f=uniform(rng);
+  const unsigned int window=2*contextsize+1;
+  std::vector<int> contexts(numcontexts*window);
+  for(int& w: contexts) w=word(rng);
+
+  KernelISA best=detect_kernel_isa();
+  std::vector<std::pair<const char*, KernelISA> > isas={{"generic", ISAGeneric}};
+  if(best>=ISAAVX2) isas.push_back({"avx2", ISAAVX2});
+  if(best>=ISAAVX512) isas.push_back({"avx512", ISAAVX512});
+
+  std::cout << std::setw(6) << "dim" << std::setw(10) << "impl" << std::setw(14) << "ns/context" << std::setw(10) << "speedup" << std::setw(14) << "max error" << '\n';
+  for(unsigned int dim: dims) {
+    std::vector<float> origvects((size_t)vocabsize*dim);
+    for(float& f: origvects) f=normal(rng);
+    std::vector<float> out(dim), ref(dim);
+    std::vector<const float*> cols(window);
+    std::vector<float> weights(window);
+
+    double legacy=time_per_context([&](size_t i) {
+	std::fill(out.begin(), out.end(), 0.0f);
+	legacy_compute_context(&contexts[i*window], idfs, origvects, out.data(), dim, contextsize);
+      }, numcontexts, repeats);
+    std::cout << std::setw(6) << dim << std::setw(10) << "legacy" << std::setw(14) << std::fixed << std::setprecision(1) << legacy << '\n';
+
+    for(auto& isa: isas) {
+      ContextKernels kernels=select_context_kernels(dim, isa.second);
+      double t=time_per_context([&](size_t i) {
+	  std::fill(out.begin(), out.end(), 0.0f);
+	  kernel_compute_context(kernels, &contexts[i*window], idfs, origvects, out.data(), dim, contextsize, cols, weights);
+	}, numcontexts, repeats);
+
+      float maxerr=0;
+      for(size_t i=0; i<std::min<size_t>(numcontexts, 1000); i++) {
+	std::fill(out.begin(), out.end(), 0.0f);
+	std::fill(ref.begin(), ref.end(), 0.0f);
+	legacy_compute_context(&contexts[i*window], idfs, origvects, ref.data(), dim, contextsize);
+	kernel_compute_context(kernels, &contexts[i*window], idfs, origvects, out.data(), dim, contextsize, cols, weights);
+	for(unsigned int d=0; d<dim; d++) {
+	  maxerr=std::max(maxerr, std::fabs(out[d]-ref[d]));
+	}
+      }
+      std::cout << std::setw(6) << dim << std::setw(10) << isa.first << std::setw(14) << t << std::setw(10) << std::setprecision(2) << legacy/t << std::setw(14) << std::scientific << maxerr << std::fixed << std::setprecision(1) << '\n';
+    }
+  }
+  return 0;
+}
@@ -24,6 +24,15 @@
 
 #include <string>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <fstream>
+#include <sstream>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string/predicate.hpp>
@@ -44,96 +53,597 @@ namespace hl=Halite;
 #endif
 
 #include "common.hpp"
+#include "contextstore.hpp"
+#include "clustermanifest.hpp"
+#include "centersfile.hpp"
+#include "sphericalkmeans.hpp"
+#include "projection.hpp"
 
 namespace po=boost::program_options;
 namespace km=mlpack::kmeans;
 
+//The objectives of a sweep over several numbers of clusters, in the cluster directory
+const std::string SWEEP_FILE="sweep.txt";
 
-int cluster_contexts(ClusterAlgos algorithm, std::string& contextdir,const std::string& clusterdir, size_t numclust, const std::string& tmpdir, int vecdim) {
-  for (boost::filesystem::directory_iterator itr(contextdir); itr!=boost::filesystem::directory_iterator(); ++itr) {
-    std::string path=itr->path().string();
-    if(!boost::algorithm::ends_with(path,".vectors")) {
-      continue;
+//The projection the contexts are clustered in, as a binary centers file of its columns, in the cluster directory
+const std::string PROJECTION_FILE="projection.bin";
+
+
+enum KMeansEngine {
+  MLPackEngine,
+  NativeEngine
+};
+
+enum CentroidInit {
+  RandomInit,
+  KMeansPPInit
+};
+
+enum ProjectionMethod {
+  NoProjection,
+  RandomProjection,
+  PCAProjection
+};
+
+struct ClusterOptions {
+  KMeansEngine engine;
+  CentroidInit init;
+  size_t maxiterations;
+  double tolerance;
+  uint64_t seed;
+  size_t batchsize;
+  size_t numbatches;
+  bool finalpass;
+  bool bounded;
+  bool dedup;
+  bool binarycenters;
+  size_t halitememory;
+  ProjectionMethod projection;
+  unsigned int projectdim;
+  size_t projectsample;
+};
+
+//Describes everything but the contexts that the clusters of a word depend on
+std::string cluster_parameters(ClusterAlgos algorithm, size_t numclust, const ClusterOptions& options) {
+  if(algorithm == HaliteAlgo) {
+    return "halite";
+  }
+  std::ostringstream parameters;
+  parameters << "kmeans numclust=" << numclust << " init=" << (options.init==KMeansPPInit?"kmeans++":"random") << " seed=" << options.seed;
+  if(options.engine == NativeEngine) {
+    parameters << " engine=native maxiter=" << options.maxiterations << " tolerance=" << options.tolerance;
+    parameters << " minibatch=" << options.batchsize << " batches=" << options.numbatches;
+    if(options.dedup) {
+      parameters << " dedup";
     }
-    if(boost::filesystem::file_size(itr->path())==0) {
-      continue;
+  } else {
+    parameters << " engine=mlpack";
+  }
+  return parameters.str();
+}
+
+//Reads the centroids of a centers file, returning false unless it has exactly centroids.n_cols of them
+bool read_centers(const std::string& path, arma::fmat& centroids) {
+  std::vector<float> centers;
+  if(!read_centers_file(path, centroids.n_rows, centers) || centers.size()!=centroids.n_elem) {
+    return false;
+  }
+  std::copy(centers.begin(), centers.end(), centroids.memptr());
+  return true;
+}
+
+/*
+ * The contexts of a word as a PointSource, projected onto the columns of
+ * projection if it is not empty.  Only the runs that are read are decoded
+ * and projected, so mini-batches of a large word in a compact encoding
+ * never hold all its contexts as floats.
+ */
+class ContextPointSource: public PointSource {
+public:
+  ContextPointSource(const WordContexts& contexts, unsigned int vecdim, const arma::fmat& projection): contexts(contexts), vecdim(vecdim), projection(projection), recordbytes(context_record_bytes(contexts.encoding, vecdim)) {
+  }
+
+  size_t numPoints() const {
+    return contexts.numpoints;
+  }
+
+  unsigned int dim() const {
+    return projection.is_empty()?vecdim:projection.n_cols;
+  }
+
+  void read(size_t first, size_t n, float* out) const {
+    const char* records=contexts.records+first*recordbytes;
+    if(projection.is_empty()) {
+      decode_contexts(contexts.encoding, records, n, vecdim, out);
+      return;
     }
+    arma::fmat decoded(vecdim, n);
+    decode_contexts(contexts.encoding, records, n, vecdim, decoded.memptr());
+    arma::fmat projected=projection.t()*decoded;
+    std::copy(projected.memptr(), projected.memptr()+projected.n_elem, out);
+  }
 
-    std::cout << path << '\n';
-    boost::iostreams::mapped_file_source file(itr->path());
-    size_t numpoints=file.size()/(vecdim*sizeof(float));
-    std::cout << numpoints << " points" <<std::endl;
-    const arma::fmat data((float*)file.data(), vecdim, numpoints, false, true);
+private:
+  const WordContexts& contexts;
+  unsigned int vecdim;
+  const arma::fmat& projection;
+  size_t recordbytes;
+};
+
+//One clustering of the words: its number of clusters, where it goes, and what was done before
+struct ClusterTarget {
+  size_t numclust;
+  std::string dir;
+  std::string parameters;
+  std::unique_ptr<ClusterManifest> manifest;
+};
+
+//Creates a uniquely named subdirectory of dir, for the temporary files of one worker.  Returns "" if it cannot
+std::string make_worker_dir(const std::string& dir) {
+  boost::filesystem::path path=boost::filesystem::unique_path(boost::filesystem::path(dir) / "cclustercontexts-%%%%-%%%%-%%%%");
+  boost::system::error_code error;
+  if(!boost::filesystem::create_directories(path, error)) {
+    return "";
+  }
+  return path.string();
+}
 
-    numclust=std::min(numpoints,numclust);
+//Removes everything in a directory, but not the directory
+void clear_directory(const std::string& dir) {
+  boost::system::error_code error;
+  for(boost::filesystem::directory_iterator itr(dir, error); !error && itr!=boost::filesystem::directory_iterator(); itr.increment(error)) {
+    boost::system::error_code ignored;
+    boost::filesystem::remove_all(itr->path(), ignored);
+  }
+}
+
+/*
+ * Clusters the contexts of the wth word of the store for each target.
+ * K-means clusters them projected onto the columns of projection, if it
+ * is not empty, and writes the centers mapped back.  Halite keeps its
+ * cache in tmpdir, or in memdir for words with no more than
+ * options.halitememory contexts; both belong to the calling worker.
+ */
+int cluster_word(ClusterAlgos algorithm, const ContextStore& store, size_t w, std::vector<ClusterTarget>& targets, const std::string& tmpdir, const std::string& memdir, int vecdim, const arma::fmat& projection, const ClusterOptions& options, std::mutex& printlock) {
+  std::unique_ptr<WordContexts> contexts;
+  try {
+    contexts=store.contexts(w);
+  } catch(std::runtime_error& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 5;
+  }
+  size_t numpoints=contexts->numpoints;
+  if(numpoints==0) {
+    return 0;
+  }
+  size_t word=store.words()[w];
+  std::string extension=algorithm == HaliteAlgo?".halite.txt":(options.binarycenters?".centers.bin":".centers.txt");
 
-    arma::Col<size_t> assignments(numpoints);
-		
-    arma::fmat centroids(vecdim,numclust);
+  //A word is skipped if its contexts are unchanged for every target, and
+  //a target is warm started if contexts were only added
+  uint64_t size=numpoints*context_record_bytes(contexts->encoding, vecdim);
+  std::vector<ManifestEntry> entries(targets.size());
+  std::vector<bool> appended(targets.size());
+  std::vector<std::string> outpaths(targets.size());
+  bool unchanged=true;
+  uint64_t checksum=0, prefix=0, prefixchecksum=0;
+  for(size_t t=0; t<targets.size(); t++) {
+    outpaths[t]=(targets[t].dir / boost::filesystem::path(std::to_string(word)+extension)).string();
+    ManifestEntry previous;
+    bool known=targets[t].manifest->find(word, previous) && previous.parameters==targets[t].parameters && boost::filesystem::exists(outpaths[t]);
+    //The contexts are only read again if the targets were last run on different contexts
+    if(t==0 || (known?previous.size:0)!=prefix) {
+      prefix=known?previous.size:0;
+      checksum=content_checksum(contexts->records, size, prefix, prefixchecksum);
+    }
+    entries[t].size=size;
+    entries[t].checksum=checksum;
+    entries[t].objective=0;
+    entries[t].parameters=targets[t].parameters;
+    appended[t]=known && previous.size < size && prefixchecksum==previous.checksum;
+    unchanged=unchanged && known && previous.size==size && previous.checksum==checksum;
+  }
+  if(unchanged) {
+    std::lock_guard<std::mutex> guard(printlock);
+    std::cout << store.name(w) << " is unchanged" << std::endl;
+    return 0;
+  }
+  {
+    std::lock_guard<std::mutex> guard(printlock);
+    std::cout << store.name(w) << '\n';
+    std::cout << numpoints << " points" <<std::endl;
+  }
+  //Mini-batches without a final pass or --dedup only read the runs they
+  //sample.  Otherwise compact encodings are decoded one word at a time
+  ContextPointSource source(*contexts, vecdim, projection);
+  SphericalKMeansClusterer clusterer(options.maxiterations, options.tolerance);
+  clusterer.batchsize=options.batchsize;
+  clusterer.numbatches=options.numbatches;
+  clusterer.finalpass=options.finalpass;
+  clusterer.bounded=options.bounded;
+  bool streamed=algorithm == SphericalKMeans && options.engine == NativeEngine && clusterer.minibatch(numpoints) && !options.finalpass && !options.dedup;
+  arma::fmat projected;
+  if(!streamed && !projection.is_empty()) {
+    projected=projection.t()*contexts->points();
+  }
+  const arma::fmat& data=streamed || !projection.is_empty()?projected:contexts->points();
+  unsigned int clusterdim=source.dim();
 
-    if(algorithm == SphericalKMeans) {
-      km::KMeans<CosineSqrKernel> k;
+  arma::Col<size_t> assignments(streamed?0:numpoints);
 
-      k.Cluster(data, numclust, assignments,centroids);
+  if(algorithm == SphericalKMeans) {
+    //The initial centroids depend only on the seed and the word, so it does
+    //not matter which thread clusters the word or in what order
+    std::mt19937_64 rng(mix_hash(options.seed^mix_hash(word)));
+    //Repeated contexts are clustered once, weighted by how often they occur.
+    //The counts are exact integers, and only become float weights here,
+    //since a float count stops growing at 2^24
+    arma::fmat distinct;
+    std::vector<uint64_t> counts;
+    std::vector<float> weights;
+    if(options.dedup) {
+      deduplicate_points(data, distinct, counts);
+      weights.assign(counts.begin(), counts.end());
+      std::lock_guard<std::mutex> guard(printlock);
+      std::cout << distinct.n_cols << " distinct points" << std::endl;
+    }
+    const arma::fmat& points=options.dedup?distinct:data;
+    size_t numclustered=streamed?numpoints:points.n_cols;
+    //Mini-batch clustering seeds from a sample, so that no step looks at every point
+    bool minibatch=options.engine == NativeEngine && clusterer.minibatch(numclustered);
+    //The norms are shared by all the targets
+    std::vector<float> invnorms;
+    if(options.engine == NativeEngine && (!minibatch || options.finalpass)) {
+      inverse_norms(points, invnorms);
+    }
 
-      boost::filesystem::path outpath=clusterdir / itr->path().filename();
-      outpath=outpath.replace_extension(".centers.txt");
-      
-      std::ofstream clusterfile(outpath.string());
-      for(unsigned int i=0; i<numclust; i++) {
-	for(int j=0; j<vecdim; j++) {
-	  clusterfile << centroids(j,i) << " ";
+    arma::fmat previous;
+    for(size_t t=0; t<targets.size(); t++) {
+      size_t numclust=std::min<size_t>(numclustered, targets[t].numclust);
+      arma::fmat centroids(clusterdim,numclust);
+      arma::fmat sample;
+      std::vector<float> sampleweights;
+      if(streamed) {
+	sample_points(source, std::max(options.batchsize, numclust), rng, sample);
+      } else if(minibatch && options.dedup) {
+	sample_points(points, counts, std::max(options.batchsize, numclust), rng, sample, sampleweights);
+      } else if(minibatch) {
+	sample_points(points, std::max(options.batchsize, numclust), rng, sample);
+      }
+      const arma::fmat& seeds=minibatch?sample:points;
+      const std::vector<float>& seedweights=minibatch?sampleweights:weights;
+      //A larger number of clusters starts from the solution with fewer
+      size_t given=std::min<size_t>(previous.n_cols, numclust);
+      for(size_t j=0; j<given; j++) {
+	std::copy(previous.colptr(j), previous.colptr(j)+clusterdim, centroids.colptr(j));
+      }
+      arma::fmat centers(vecdim,numclust);
+      if(appended[t] && read_centers(outpaths[t], centers)) {
+	if(!projection.is_empty()) {
+	  centers=projection.t()*centers;
 	}
-	clusterfile << '\n';
+	centroids=centers;
+	std::lock_guard<std::mutex> guard(printlock);
+	std::cout << "warm start from " << outpaths[t] << std::endl;
+      } else if(options.init == KMeansPPInit) {
+	kmeanspp_centroids(seeds, rng, centroids, given, options.dedup?seedweights.data():nullptr);
+      } else {
+	random_centroids(seeds, rng, centroids, given);
+      }
+
+      if(streamed) {
+	entries[t].objective=clusterer.cluster(source, centroids, rng);
+      } else if(options.engine == NativeEngine) {
+	entries[t].objective=clusterer.cluster(points, invnorms, weights, centroids, assignments, rng);
+      } else {
+	km::KMeans<CosineSqrKernel> k;
+	k.Cluster(points, numclust, assignments, centroids, false, true);
+	entries[t].objective=mean_squared_cosine(points, centroids);
       }
-      clusterfile.close();
-    } else if(algorithm == HaliteAlgo) {
+      if(targets.size()>1) {
+	std::lock_guard<std::mutex> guard(printlock);
+	std::cout << store.name(w) << ": " << numclust << " clusters, objective " << entries[t].objective << std::endl;
+      }
+
+      centers=projection.is_empty()?centroids:projection*centroids;
+      bool written=write_file_atomically(outpaths[t], [&](std::ostream& clusterfile) {
+	  if(options.binarycenters) {
+	    write_centers_file(clusterfile, centers.memptr(), numclust, vecdim);
+	    return;
+	  }
+	  for(unsigned int i=0; i<numclust; i++) {
+	    for(int j=0; j<vecdim; j++) {
+	      clusterfile << centers(j,i) << " ";
+	    }
+	    clusterfile << '\n';
+	  }
+	});
+      if(!written) {
+	std::cerr << "Error: could not write " << outpaths[t] << "\n";
+	return 6;
+      }
+      //The centers in the other format are out of date
+      boost::system::error_code error;
+      boost::filesystem::remove(boost::filesystem::path(outpaths[t]).replace_extension(options.binarycenters?".txt":".bin"), error);
+      previous=centroids;
+    }
+  } else if(algorithm == HaliteAlgo) {
 #ifndef ENABLE_HALITE
-      std::cerr<<"Error: Attempted to use Halite clustering when it was disabled at compile time\n";
-      exit(1);
+    std::cerr<<"Error: Attempted to use Halite clustering when it was disabled at compile time\n";
+    exit(1);
 #else
+    const std::string& outpath=outpaths[0];
     hl::PackedArrayPointSource<float> pts(data.memptr(), vecdim, numpoints);
     
-    hl::HaliteClustering<float> h(pts, true, tmpdir);
-    h.findCorrelationClusters();
-    shared_ptr<hl::Classifier<float> > classifier=h.getClassifier();
+    //Small words keep their cache in memory, and nothing is kept between words
+    const std::string& cachedir=numpoints<=options.halitememory?memdir:tmpdir;
+    shared_ptr<hl::Classifier<float> > classifier;
+    {
+      hl::HaliteClustering<float> h(pts, true, cachedir);
+      h.findCorrelationClusters();
+      classifier=h.getClassifier();
+    }
+    clear_directory(cachedir);
     classifier->denormalize();
     
-    boost::filesystem::path outpath=clusterdir / itr->path().filename();
-    outpath=outpath.replace_extension(".halite.txt");
-    std::ofstream clusterfile(outpath.string());
-    for(const hl::BetaCluster<float>& b: classifier->betaClusters) {
-      
-      clusterfile << b.correlationCluster<<"\n";
-      for(unsigned char c: b.relevantDimension) {
-	clusterfile << (c?"1 ":"0 ");
+    bool written=write_file_atomically(outpath, [&](std::ostream& clusterfile) {
+	for(const hl::BetaCluster<float>& b: classifier->betaClusters) {
+
+	  clusterfile << b.correlationCluster<<"\n";
+	  for(unsigned char c: b.relevantDimension) {
+	    clusterfile << (c?"1 ":"0 ");
+	  }
+	  clusterfile<<"\n";
+	  for(float f:b.min) {
+	    clusterfile << f << " ";
+	  }
+	  clusterfile <<"\n";
+	  for(float f:b.max) {
+	    clusterfile << f << " ";
+	  }
+	  clusterfile<<"\n";
+	}
+      });
+    if(!written) {
+      std::cerr << "Error: could not write " << outpath << "\n";
+      return 6;
+    }
+#endif
+  }
+  //Only recorded once the clusters are in place, so an interrupted word is redone
+  for(size_t t=0; t<targets.size(); t++) {
+    targets[t].manifest->record(word, entries[t]);
+  }
+  return 0;
+}
+
+/*
+ * Sets projection to the one options asks for.  A PCA projection is
+ * learned from a sample of the contexts of the store the first time, and
+ * read back from the cluster directory after that, so that the words
+ * clustered by a later run are in the same space.
+ */
+int make_projection(const ContextStore& store, const std::string& clusterdir, unsigned int vecdim, const ClusterOptions& options, arma::fmat& projection) {
+  if(options.projection == RandomProjection) {
+    random_projection(vecdim, options.projectdim, mix_hash(options.seed), projection);
+    return 0;
+  }
+  std::string path=(clusterdir / boost::filesystem::path(PROJECTION_FILE)).string();
+  if(boost::filesystem::exists(path)) {
+    std::vector<float> columns;
+    if(!read_centers_file(path, vecdim, columns) || columns.size()!=(size_t)vecdim*options.projectdim) {
+      std::cerr << "Error: " << path << " is not a projection to " << options.projectdim << " dimensions\n";
+      return 5;
+    }
+    projection.set_size(vecdim, options.projectdim);
+    std::copy(columns.begin(), columns.end(), projection.memptr());
+    std::cout << "Using the projection in " << path << std::endl;
+    return 0;
+  }
+
+  //Each word gives its share of the sample, at random places
+  size_t recordbytes=context_record_bytes(store.contextEncoding(), vecdim);
+  std::vector<uint64_t> firsts(store.words().size()+1, 0);
+  for(size_t w=0; w<store.words().size(); w++) {
+    firsts[w+1]=firsts[w]+store.size(w)/recordbytes;
+  }
+  uint64_t total=firsts.back();
+  size_t samplesize=std::min<uint64_t>(total, options.projectsample);
+  if(samplesize<options.projectdim) {
+    std::cerr << "Error: too few contexts to learn a projection to " << options.projectdim << " dimensions\n";
+    return 5;
+  }
+  arma::fmat sample(vecdim, samplesize);
+  std::mt19937_64 rng(mix_hash(options.seed));
+  size_t taken=0;
+  for(size_t w=0; w<store.words().size(); w++) {
+    size_t share=firsts[w+1]*samplesize/total-taken;
+    if(share==0) {
+      continue;
+    }
+    std::unique_ptr<WordContexts> contexts;
+    try {
+      contexts=store.contexts(w);
+    } catch(std::runtime_error& e) {
+      std::cerr << "Error: " << e.what() << "\n";
+      return 5;
+    }
+    const arma::fmat& points=contexts->points();
+    //File sizes include headers, so a word can have fewer contexts than its share, and the next word makes it up
+    if(points.n_cols==0) {
+      continue;
+    }
+    std::uniform_int_distribution<size_t> pick(0, points.n_cols-1);
+    for(size_t i=0; i<share; i++, taken++) {
+      size_t p=pick(rng);
+      std::copy(points.colptr(p), points.colptr(p)+vecdim, sample.colptr(taken));
+    }
+  }
+  sample.resize(vecdim, taken);
+  double kept=pca_projection(sample, options.projectdim, projection);
+  if(kept<0) {
+    std::cerr << "Error: could not learn a projection\n";
+    return 5;
+  }
+  std::cout << "PCA projection to " << options.projectdim << " dimensions keeps " << kept << " of the squared norm of " << taken << " contexts" << std::endl;
+  bool written=write_file_atomically(path, [&](std::ostream& out) {
+      write_centers_file(out, projection.memptr(), options.projectdim, vecdim);
+    });
+  if(!written) {
+    std::cerr << "Error: could not write " << path << "\n";
+    return 6;
+  }
+  return 0;
+}
+
+int cluster_contexts(ClusterAlgos algorithm, std::string& contextdir,const std::string& clusterdir, const std::vector<size_t>& numclusts, const std::string& tmpdir, const std::string& memdir, int vecdim, unsigned int numthreads, const ClusterOptions& options) {
+  std::unique_ptr<ContextStore> store;
+  try {
+    store.reset(new ContextStore(contextdir, vecdim));
+  } catch(std::runtime_error& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 5;
+  }
+
+  //The cost of clustering a word grows with its number of contexts, and a
+  //few words have most of them, so the largest words are started first
+  std::vector<size_t> order(store->words().size());
+  std::vector<uint64_t> sizes(order.size());
+  for(size_t w=0; w<order.size(); w++) {
+    order[w]=w;
+    sizes[w]=store->size(w);
+  }
+  std::stable_sort(order.begin(), order.end(), [&sizes](size_t a, size_t b) { return sizes[a]>sizes[b]; });
+
+  arma::fmat projection;
+  std::string projectionid;
+  if(options.projection != NoProjection) {
+    int retcode=make_projection(*store, clusterdir, vecdim, options, projection);
+    if(retcode) {
+      return retcode;
+    }
+    //Words clustered in another projection must be clustered again
+    uint64_t unused;
+    std::ostringstream id;
+    id << " projection=" << std::hex << content_checksum((const char*)projection.memptr(), projection.n_elem*sizeof(float), 0, unused);
+    projectionid=id.str();
+  }
+
+  //A sweep over several numbers of clusters puts each in its own subdirectory
+  std::vector<ClusterTarget> targets(numclusts.size());
+  for(size_t t=0; t<targets.size(); t++) {
+    targets[t].numclust=numclusts[t];
+    targets[t].dir=clusterdir;
+    if(numclusts.size()>1) {
+      targets[t].dir=(clusterdir / boost::filesystem::path(std::to_string(numclusts[t]))).string();
+      boost::system::error_code error;
+      boost::filesystem::create_directory(targets[t].dir, error);
+    }
+    targets[t].parameters=cluster_parameters(algorithm, numclusts[t], options)+projectionid;
+    try {
+      targets[t].manifest.reset(new ClusterManifest(targets[t].dir));
+    } catch(std::runtime_error& e) {
+      std::cerr << "Error: " << e.what() << "\n";
+      return 6;
+    }
+  }
+
+  if(numthreads>1) {
+    //Each worker already has a core, so BLAS should not start threads of its own
+    pin_blas_threads();
+  }
+
+  //Each worker takes the largest remaining word until they are all done or one fails
+  std::atomic<size_t> next(0);
+  std::atomic<int> result(0);
+  std::mutex printlock;
+  auto worker=[&]() {
+    //Halite's caches are files, so each worker has directories of its own
+    std::string workertmp, workermem;
+    if(algorithm == HaliteAlgo) {
+      workertmp=make_worker_dir(tmpdir);
+      if(options.halitememory) {
+	workermem=make_worker_dir(memdir);
       }
-      clusterfile<<"\n";
-      for(float f:b.min) {
-	clusterfile << f << " ";
+      if(workertmp.empty() || (options.halitememory && workermem.empty())) {
+	std::lock_guard<std::mutex> guard(printlock);
+	std::cerr << "Error: could not create a temporary directory\n";
+	result=6;
       }
-      clusterfile <<"\n";
-      for(float f:b.max) {
-	clusterfile << f << " ";
+    }
+    size_t j;
+    while(result==0 && (j=next++)<order.size()) {
+      int retcode=cluster_word(algorithm, *store, order[j], targets, workertmp, workermem, vecdim, projection, options, printlock);
+      if(retcode) {
+	result=retcode;
       }
-      clusterfile<<"\n";
     }
-    clusterfile.close();
-#endif
+    boost::system::error_code error;
+    for(const std::string& dir: {workertmp, workermem}) {
+      if(!dir.empty()) {
+	boost::filesystem::remove_all(dir, error);
+      }
     }
+  };
 
+  std::vector<std::thread> threads;
+  for(unsigned int t=1; t<numthreads; t++) {
+    threads.emplace_back(worker);
   }
-  return 0;
+  worker();
+  for(std::thread& t: threads) {
+    t.join();
+  }
+
+  if(result==0 && targets.size()>1) {
+    //The objective of each word for each number of clusters, to choose among them
+    std::vector<std::map<size_t, ManifestEntry> > done;
+    for(ClusterTarget& target: targets) {
+      done.push_back(target.manifest->snapshot());
+    }
+    std::string sweeppath=(clusterdir / boost::filesystem::path(SWEEP_FILE)).string();
+    bool written=write_file_atomically(sweeppath, [&](std::ostream& out) {
+	out << "word";
+	for(size_t numclust: numclusts) {
+	  out << ' ' << numclust;
+	}
+	out << '\n';
+	for(size_t word: store->words()) {
+	  bool complete=true;
+	  for(size_t t=0; t<targets.size(); t++) {
+	    auto it=done[t].find(word);
+	    complete=complete && it!=done[t].end() && it->second.parameters==targets[t].parameters;
+	  }
+	  if(!complete) {
+	    continue;
+	  }
+	  out << word;
+	  for(size_t t=0; t<targets.size(); t++) {
+	    out << ' ' << done[t][word].objective;
+	  }
+	  out << '\n';
+	}
+      });
+    if(!written) {
+      std::cerr << "Error: could not write " << sweeppath << "\n";
+      return 6;
+    }
+  }
+  return result;
 }
 
 
 int main(int argc, char** argv) {
   std::string contextdir;
   std::string clusterdir;
-  size_t numclust;
+  std::string numclust;
    unsigned int dim;
 
   std::string tmpdir;
+  std::string memdir;
+  unsigned int numthreads;
+  std::string engine, init, project;
+  ClusterOptions options;
   
   po::options_description desc("CClusterContexts Options");
   desc.add_options()
@@ -146,10 +656,31 @@ int main(int argc, char** argv) {
 #endif
     ("contexts,i", po::value<std::string>(&contextdir)->value_name("<directory>")->required(), "directory of contexts to cluster")
     ("clusters,o", po::value<std::string>(&clusterdir)->value_name("<directory>")->required(), "directory to output clusters")
-    ("numclust,n", po::value<size_t>(&numclust)->value_name("<number>")->default_value(10),"number of clusters (kmeans only)")
+    ("numclust,n", po::value<std::string>(&numclust)->value_name("<number>[,<number>...]")->default_value("10"),"number of clusters, or a comma separated list to cluster with each (kmeans only)")
     ("tmpdir,t", po::value<std::string>(&tmpdir)->value_name("<directory>")->default_value("."), "temporary directory for disk cache")
+    ("halite-memory", po::value<size_t>(&options.halitememory)->value_name("<points>")->default_value(0), "keep the cache of words with at most this many contexts in --memdir (halite only)")
+    ("memdir", po::value<std::string>(&memdir)->value_name("<directory>")->default_value("/dev/shm"), "memory backed directory for small words' caches")
     ("dim,d", po::value<unsigned int>(&dim)->value_name("<number>")->default_value(50),"word vector dimension")
+    ("threads,j", po::value<unsigned int>(&numthreads)->value_name("<number>")->default_value(1), "number of words to cluster at once")
+    ("binary", "write the centers as binary N.centers.bin files (kmeans only)")
     ;
+  po::options_description kmeans("K-Means Options");
+  kmeans.add_options()
+    ("engine", po::value<std::string>(&engine)->value_name("<mlpack|native>")->default_value("mlpack"), "k-means implementation")
+    ("init", po::value<std::string>(&init)->value_name("<random|kmeans++>")->default_value("random"), "how to choose the initial centroids")
+    ("seed", po::value<uint64_t>(&options.seed)->value_name("<number>")->default_value(1), "random seed for the initial centroids")
+    ("maxiter", po::value<size_t>(&options.maxiterations)->value_name("<number>")->default_value(100), "maximum number of iterations (native only)")
+    ("tolerance", po::value<double>(&options.tolerance)->value_name("<number>")->default_value(1e-4), "stop when the objective improves by less than this fraction (native only)")
+    ("bounds", "skip the assignments that the triangle inequality rules out (native only)")
+    ("minibatch", po::value<size_t>(&options.batchsize)->value_name("<points>")->default_value(0), "use mini-batches of this many points for words with more points (native only, 0 to disable)")
+    ("batches", po::value<size_t>(&options.numbatches)->value_name("<number>")->default_value(100), "maximum number of mini-batches per word (native only)")
+    ("finalpass", "assign all the points once after the mini-batches (native only)")
+    ("dedup", "cluster each distinct context once, weighted by how often it occurs (native only)")
+    ("project", po::value<std::string>(&project)->value_name("<random|pca>"), "cluster the contexts projected to --project-dim dimensions")
+    ("project-dim", po::value<unsigned int>(&options.projectdim)->value_name("<number>")->default_value(0), "number of dimensions to project to")
+    ("project-sample", po::value<size_t>(&options.projectsample)->value_name("<points>")->default_value(100000), "number of contexts to learn a PCA projection from")
+    ;
+  desc.add(kmeans);
 
   po::variables_map vm;
   po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -187,5 +718,93 @@ int main(int argc, char** argv) {
   }
 
 
-  return cluster_contexts(algorithm, contextdir, clusterdir, numclust, tmpdir, dim);
+  if(numthreads==0) {
+    std::cerr << "Error: --threads must be at least 1\n";
+    return 5;
+  }
+
+  if(engine=="mlpack") {
+    options.engine=MLPackEngine;
+  } else if(engine=="native") {
+    options.engine=NativeEngine;
+  } else {
+    std::cerr << "Error: unknown k-means engine " << engine << "\n";
+    return 5;
+  }
+  if(init=="random") {
+    options.init=RandomInit;
+  } else if(init=="kmeans++") {
+    options.init=KMeansPPInit;
+  } else {
+    std::cerr << "Error: unknown centroid initialization " << init << "\n";
+    return 5;
+  }
+  options.finalpass=vm.count("finalpass");
+  options.bounded=vm.count("bounds");
+  options.dedup=vm.count("dedup");
+  options.binarycenters=vm.count("binary");
+  //mlpack would silently ignore the options of the native engine
+  if(options.engine!=NativeEngine) {
+    for(const char* name: {"maxiter", "tolerance", "bounds", "minibatch", "batches", "finalpass", "dedup"}) {
+      if(vm.count(name) && !vm[name].defaulted()) {
+	std::cerr << "Error: --" << name << " needs --engine native\n";
+	return 5;
+      }
+    }
+  }
+  if(project.empty()) {
+    options.projection=NoProjection;
+  } else if(project=="random") {
+    options.projection=RandomProjection;
+  } else if(project=="pca") {
+    options.projection=PCAProjection;
+  } else {
+    std::cerr << "Error: unknown projection " << project << "\n";
+    return 5;
+  }
+  if(options.projection!=NoProjection && (options.projectdim==0 || options.projectdim>dim)) {
+    std::cerr << "Error: --project-dim must be between 1 and --dim\n";
+    return 5;
+  }
+  if(options.projection!=NoProjection && algorithm==HaliteAlgo) {
+    std::cerr << "Error: Halite clustering cannot use a projection\n";
+    return 5;
+  }
+
+  std::vector<size_t> numclusts;
+  std::istringstream numclustlist(numclust);
+  std::string item;
+  while(std::getline(numclustlist, item, ',')) {
+    //stoul would skip leading spaces, wrap negative numbers around and
+    //ignore trailing junk, so only whole runs of digits are taken
+    size_t k=0;
+    if(!item.empty() && item[0]>='0' && item[0]<='9') {
+      try {
+	size_t pos=0;
+	k=std::stoul(item, &pos);
+	if(pos!=item.size()) {
+	  k=0;
+	}
+      } catch(std::logic_error&) {
+      }
+    }
+    if(k==0) {
+      std::cerr << "Error: bad number of clusters " << item << "\n";
+      return 5;
+    }
+    numclusts.push_back(k);
+  }
+  //Smaller solutions seed the larger ones
+  std::sort(numclusts.begin(), numclusts.end());
+  numclusts.erase(std::unique(numclusts.begin(), numclusts.end()), numclusts.end());
+  if(numclusts.empty()) {
+    std::cerr << "Error: no number of clusters given\n";
+    return 5;
+  }
+  if(numclusts.size()>1 && algorithm==HaliteAlgo) {
+    std::cerr << "Error: Halite clustering does not take a number of clusters\n";
+    return 5;
+  }
+
+  return cluster_contexts(algorithm, contextdir, clusterdir, numclusts, tmpdir, memdir, dim, numthreads, options);
 }
@@ -0,0 +1,92 @@
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Jeremy Salwen nor the name of any other
+//    contributor may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+
+#include <boost/program_options.hpp>
+
+#include "wordmodel.hpp"
+
+namespace po=boost::program_options;
+
+int main(int argc, char** argv) {
+  std::string vocabf;
+  std::string idff;
+  std::string vecf;
+  std::string modelf;
+  unsigned int dim;
+
+  po::options_description desc("CConvertModel Options");
+  desc.add_options()
+    ("help,h", "produce help message")
+    ("vocab,v", po::value<std::string>(&vocabf)->value_name("<filename>")->required(), "vocab file")
+    ("idf,i", po::value<std::string>(&idff)->value_name("<filename>")->required(), "idf file")
+    ("vec,w", po::value<std::string>(&vecf)->value_name("<filename>")->required(), "word vectors file")
+    ("model,m", po::value<std::string>(&modelf)->value_name("<filename>")->required(), "output binary model file")
+    ("dim,d", po::value<unsigned int>(&dim)->value_name("<number>")->default_value(50),"word vector dimension")
+    ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << "\n";
+    return 0;
+  }
+  try {
+    po::notify(vm);
+  } catch(po::required_option& exception) {
+    std::cerr << "Error: " << exception.what() << "\n";
+    std::cout << desc << "\n";
+    return 1;
+  }
+
+  std::ifstream vocab(vocabf);
+  if(!vocab.good()) {
+    std::cerr << "Vocab file no good" <<std::endl;
+    return 2;
+  }
+  std::ifstream frequencies(idff);
+  if(!frequencies.good()) {
+    std::cerr << "Frequencies file no good" <<std::endl;
+    return 3;
+  }
+  std::ifstream vectors(vecf);
+  if(!vectors.good()) {
+    std::cerr << "Vectors file no good" <<std::endl;
+    return 4;
+  }
+
+  try {
+    WordModel model;
+    model.loadText(vocab, frequencies, vectors, dim);
+    model.save(modelf);
+  } catch(std::runtime_error& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 5;
+  }
+  return 0;
+}
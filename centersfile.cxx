@@ -0,0 +1,70 @@
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Jeremy Salwen nor the name of any other
+//    contributor may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "centersfile.hpp"
+
+#include <fstream>
+#include <algorithm>
+
+bool write_centers_file(std::ostream& out, const float* centers, uint64_t numcenters, unsigned int dim) {
+  CentersFileHeader header;
+  std::copy(CENTERS_FILE_MAGIC, CENTERS_FILE_MAGIC+8, header.magic);
+  header.dim=dim;
+  header.reserved=0;
+  header.numcenters=numcenters;
+  out.write((const char*)&header, sizeof(header));
+  out.write((const char*)centers, numcenters*dim*sizeof(float));
+  return out.good();
+}
+
+bool read_centers_header(std::istream& in, CentersFileHeader& header) {
+  std::streampos start=in.tellg();
+  if(in.read((char*)&header, sizeof(header)) && std::equal(CENTERS_FILE_MAGIC, CENTERS_FILE_MAGIC+8, header.magic)) {
+    return true;
+  }
+  in.clear();
+  in.seekg(start);
+  return false;
+}
+
+bool read_centers_file(const std::string& path, unsigned int dim, std::vector<float>& centers) {
+  std::ifstream in(path, std::ios::binary);
+  if(!in) {
+    return false;
+  }
+  CentersFileHeader header;
+  if(read_centers_header(in, header)) {
+    if(header.dim!=dim) {
+      return false;
+    }
+    centers.resize(header.numcenters*dim);
+    return (bool)in.read((char*)centers.data(), centers.size()*sizeof(float));
+  }
+  centers.clear();
+  float value;
+  while(in >> value) {
+    centers.push_back(value);
+  }
+  return in.eof() && centers.size()%dim==0;
+}
@@ -0,0 +1,66 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Jeremy Salwen nor the name of any other
+ *    contributor may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef CENTERS_FILE_H
+#define CENTERS_FILE_H
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+
+/*
+ * A binary centers file holds cluster centers as raw floats, one center
+ * after another, after a CentersFileHeader.  CClusterContexts writes one
+ * per word, N.centers.bin, and CExpandVocab can write all the centers of
+ * the expanded vocabulary as one, in expanded vocabulary order.
+ */
+const char CENTERS_FILE_MAGIC[8]={'C','M','V','C','N','T','R','S'};
+
+struct CentersFileHeader {
+  char magic[8];
+  uint32_t dim;
+  uint32_t reserved;
+  uint64_t numcenters;
+};
+
+//Writes numcenters centers of dimension dim, stored one after another, as a binary centers file
+bool write_centers_file(std::ostream& out, const float* centers, uint64_t numcenters, unsigned int dim);
+
+/*
+ * Reads the header of a binary centers file.  If in is not at the start
+ * of one, returns false and puts in back where it was.
+ */
+bool read_centers_header(std::istream& in, CentersFileHeader& header);
+
+/*
+ * Sets centers to all the centers of a binary or text centers file, one
+ * after another.  A text file has one center per line.  Returns false if
+ * the file cannot be read or does not hold centers of dimension dim.
+ */
+bool read_centers_file(const std::string& path, unsigned int dim, std::vector<float>& centers);
+
+#endif
@@ -30,41 +30,146 @@
 #include <boost/filesystem/fstream.hpp>
 #include <boost/program_options.hpp>
 #include <boost/unordered_map.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 
 #include <armadillo>
 #include "common.hpp"
+#include "centersfile.hpp"
 
 namespace po=boost::program_options;
 namespace fs=boost::filesystem;
 
 
-int expand_vocab(ClusterAlgos format, fs::ifstream& vocabin, fs::ofstream& vocabout, fs::ofstream& ocenterstream, const std::string& clusterdir, int dim) {
+//Reads a whole file into contents
+static bool read_whole_file(const fs::path& path, std::string& contents) {
+  fs::ifstream in(path, std::ios::binary);
+  if(!in) {
+    return false;
+  }
+  in.seekg(0, std::ios::end);
+  contents.resize(in.tellg());
+  in.seekg(0);
+  return (bool)in.read(&contents[0], contents.size());
+}
+
+/*
+ * Finds the centers files of a clusters directory with one listing, rather
+ * than checking for each word in the vocabulary.  A binary file is used
+ * over a text one.
+ */
+static boost::unordered_map<unsigned int, fs::path> find_centers_files(const fs::path& clusterpath) {
+  boost::unordered_map<unsigned int, fs::path> files;
+  for(fs::directory_iterator itr(clusterpath); itr!=fs::directory_iterator(); ++itr) {
+    std::string name=itr->path().filename().string();
+    bool binary=boost::algorithm::ends_with(name, ".centers.bin");
+    if(!binary && !boost::algorithm::ends_with(name, ".centers.txt")) {
+      continue;
+    }
+    size_t end;
+    unsigned int index;
+    try {
+      index=std::stoul(name, &end);
+    } catch(std::logic_error&) {
+      continue;
+    }
+    if(name[end]!='.') {
+      continue;
+    }
+    if(binary || files.find(index)==files.end()) {
+      files[index]=itr->path();
+    }
+  }
+  return files;
+}
+
+//Writes n centers, one after another, as raw floats or as one line of text each
+static void write_centers(const float* centers, size_t n, int dim, bool binary, std::ostream& out) {
+  if(binary) {
+    out.write((const char*)centers, n*dim*sizeof(float));
+    return;
+  }
+  for(size_t i=0; i<n; i++) {
+    for(int j=0; j<dim; j++) {
+      out << centers[i*dim+j] << " ";
+    }
+    out << '\n';
+  }
+}
+
+/*
+ * Copies the contents of a centers file to out as they are, without the
+ * header of a binary file, and sets numclust to its number of centers.
+ * Returns false if a binary file is malformed.
+ */
+static bool copy_centers(const std::string& contents, bool binary, int dim, std::ostream& out, size_t& numclust) {
+  if(binary) {
+    const CentersFileHeader* header=(const CentersFileHeader*)contents.data();
+    if(contents.size()<sizeof(CentersFileHeader) || !std::equal(CENTERS_FILE_MAGIC, CENTERS_FILE_MAGIC+8, header->magic) || header->dim!=(uint32_t)dim || contents.size()!=sizeof(CentersFileHeader)+header->numcenters*dim*sizeof(float)) {
+      return false;
+    }
+    numclust=header->numcenters;
+    out.write(contents.data()+sizeof(CentersFileHeader), contents.size()-sizeof(CentersFileHeader));
+    return true;
+  }
+  numclust=std::count(contents.begin(), contents.end(), '\n');
+  out << contents;
+  if(!contents.empty() && contents.back()!='\n') {
+    out << '\n';
+    numclust++;
+  }
+  return true;
+}
+
+int expand_vocab(ClusterAlgos format, fs::ifstream& vocabin, fs::ofstream& vocabout, fs::ofstream& ocenterstream, const std::string& clusterdir, int dim, bool binary) {
 
   fs::path clusterpath(clusterdir);
+  boost::unordered_map<unsigned int, fs::path> centersfiles;
+  if(format==SphericalKMeans) {
+    centersfiles=find_centers_files(clusterpath);
+  }
+
+  //A binary centers file starts with its header, which is filled in at the end
+  uint64_t numcenters=0;
+  std::vector<float> zeros(dim, 0);
+  if(format==SphericalKMeans && binary) {
+    write_centers_file(ocenterstream, zeros.data(), 0, dim);
+  }
 
   std::string word;
+  std::string contents;
+  std::vector<float> centers;
   unsigned int index=0;
   while(getline(vocabin,word)) {
     std::stringstream ss;
     if(format==SphericalKMeans) {
-      ss << index << ".centers.txt";
-      fs::path cfile=clusterpath / ss.str();
-		
-      int defn=0;
-      if(fs::exists(cfile)) {
-	fs::ifstream clusterfile(cfile);
-	std::string clustervec;
-	while(getline(clusterfile,clustervec)) {
-	  vocabout << std::setfill ('0') << std::setw (3) << defn++ <<word <<'\n';
-	  ocenterstream << clustervec << '\n';
-	}
-      } else {
-	vocabout <<  std::setfill ('0') << std::setw (3) << 0 <<word <<'\n';
-	for(int i=0; i<dim; i++) { //Fill with zeros if there are no clusters
-	  ocenterstream << "0 ";
+      auto found=centersfiles.find(index);
+      size_t numclust=0;
+      if(found!=centersfiles.end()) {
+	const fs::path& cfile=found->second;
+	if((cfile.extension()==".bin") == binary) {
+	  //The centers are already in the output format, so they are copied in one block
+	  if(!read_whole_file(cfile, contents) || !copy_centers(contents, binary, dim, ocenterstream, numclust)) {
+	    std::cerr << "Error: could not read centers of dimension " << dim << " from " << cfile.string() << "\n";
+	    return 7;
+	  }
+	} else {
+	  if(!read_centers_file(cfile.string(), dim, centers)) {
+	    std::cerr << "Error: could not read centers of dimension " << dim << " from " << cfile.string() << "\n";
+	    return 7;
+	  }
+	  numclust=centers.size()/dim;
+	  write_centers(centers.data(), numclust, dim, binary, ocenterstream);
 	}
-	ocenterstream << '\n';
       }
+      if(numclust==0) {
+	//Fill with zeros if there are no clusters
+	write_centers(zeros.data(), 1, dim, binary, ocenterstream);
+	numclust=1;
+      }
+      for(size_t defn=0; defn<numclust; defn++) {
+	vocabout << std::setfill ('0') << std::setw (3) << defn <<word <<'\n';
+      }
+      numcenters+=numclust;
     } else if(format==HaliteAlgo) {
 #ifndef ENABLE_HALITE
       std::cerr<<"Error: Attempted to use Halite clustering when it was disabled at compile time\n";
@@ -104,6 +209,19 @@ int expand_vocab(ClusterAlgos format, fs::ifstream& vocabin, fs::ofstream& vocab
     }
     index++;
   }
+  if(format==SphericalKMeans && binary) {
+    CentersFileHeader header;
+    std::copy(CENTERS_FILE_MAGIC, CENTERS_FILE_MAGIC+8, header.magic);
+    header.dim=dim;
+    header.reserved=0;
+    header.numcenters=numcenters;
+    ocenterstream.seekp(0);
+    ocenterstream.write((const char*)&header, sizeof(header));
+  }
+  if(!ocenterstream.good()) {
+    std::cerr << "Error: could not write the centers\n";
+    return 8;
+  }
   return 0;
 }
 
@@ -124,6 +242,7 @@ int main(int argc, char** argv) {
     ("ivocab,v", po::value<std::string>(&vocabf)->value_name("<filename>")->required(), "original vocab file")
     ("ovocab", po::value<std::string>(&ovocabf)->value_name("<filename>")->required(), "output vocab file")
     ("centers", po::value<std::string>(&ocenterf)->value_name("<filename>")->required(), "output cluster centers")
+    ("binary", "write the centers as a binary centers file (kmeans only)")
     ("clusters,c", po::value<std::string>(&clusterdir)->value_name("<directory>")->required(), "clusters directory")
     ("dim,d", po::value<unsigned int>(&dim)->value_name("<number>")->default_value(50),"word vector dimension")
     ;
@@ -164,7 +283,7 @@ int main(int argc, char** argv) {
     std::cerr << "Output vocab file no good" <<std::endl;
     return 4;
   }
-  fs::ofstream ocenter(ocenterf);
+  fs::ofstream ocenter(ocenterf, std::ios::binary);
   if(!ocenter.good()) {
     std::cerr << "Output context mapping file no good" <<std::endl;
     return 5;
@@ -175,5 +294,5 @@ int main(int argc, char** argv) {
   }
 
 
-  return expand_vocab(format, ivocab,ovocab, ocenter, clusterdir, dim);
+  return expand_vocab(format, ivocab,ovocab, ocenter, clusterdir, dim, vm.count("binary")>0);
 }
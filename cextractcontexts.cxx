@@ -28,16 +28,21 @@
 #include <numeric>
 #include <sstream>
 #include <queue>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
 
 #include <sys/resource.h>
 
 #include <boost/filesystem.hpp>
 #include <boost/circular_buffer.hpp>
-#include <boost/unordered_map.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/program_options.hpp>
 
 #include "common.hpp"
+#include "contextfile.hpp"
+#include "contextstore.hpp"
 
 namespace po=boost::program_options;
 
@@ -51,7 +56,7 @@ struct FileCacheEntry {
 
 class CachingFileArray {
 public:
-  CachingFileArray(std::function<std::string (size_t)> f_namer, size_t numFiles, size_t cachesize): cachesize(cachesize), file_namer(f_namer), queuesize(0), entries(numFiles)  {
+  CachingFileArray(std::function<std::string (size_t)> f_namer, size_t numFiles, size_t cachesize, bool overwritable=false, const std::string& header=std::string()): cachesize(cachesize), file_namer(f_namer), queuesize(0), entries(numFiles), reopenmode(overwritable?"r+b":"ab"), header(header)  {
 
   }
 
@@ -81,11 +86,16 @@ protected:
     FileCacheEntry& e=entries[id];
     std::string fname=file_namer(id);
 
-    e.file = fopen(fname.c_str(), e.initialized?"ab":"wb");
+    e.file = fopen(fname.c_str(), e.initialized?reopenmode:"wb");
     
     if(e.file==NULL) {
       return NULL;
     }
+    if(!e.initialized && !header.empty() && fwrite(header.data(), 1, header.size(), e.file) != header.size()) {
+      fclose(e.file);
+      e.file=NULL;
+      return NULL;
+    }
     queue.push_front(&e);
     queuesize++;
     e.iterator=queue.begin();
@@ -115,81 +125,422 @@ std::function<std::string (size_t)> file_namer;
 std::list<FileCacheEntry*> queue;
 size_t queuesize;
 std::vector<FileCacheEntry> entries;
+//Files opened for appending cannot be written in the middle
+const char* reopenmode;
+//Written at the start of every new file
+std::string header;
+};
+
+//Default number of open files kept by the writer's file cache
+const size_t DEFAULT_FCACHESIZE=1024;
+
+//A word's buffered contexts are written out once they reach this size
+const size_t MAX_BUCKET_BYTES=1024*1024;
+
+/*
+ * Where a BufferedContextWriter's contexts go.  The words are numbered
+ * locally within a stripe, and id is the word id for error messages.
+ */
+class ContextSink {
+public:
+  virtual ~ContextSink() {}
+
+  //Appends bytes to the contexts of word local.  Returns 0 on success
+  virtual int append(size_t local, size_t id, const char* data, size_t bytes)=0;
+
+  //Overwrites contexts of word local that were already appended, starting offset bytes into them
+  virtual int overwrite(size_t local, size_t id, uint64_t offset, const char* data, size_t bytes)=0;
+
+  virtual void close()=0;
+};
+
+//Appends the contexts of each word to its own .vectors file
+class FileContextSink: public ContextSink {
+public:
+  FileContextSink(std::function<std::string (size_t)> f_namer, size_t numFiles, size_t cachesize, bool overwritable, const std::string& header): files(f_namer, numFiles, cachesize, overwritable, header), overwritable(overwritable), headerbytes(header.size()) {
+  }
+
+  int append(size_t local, size_t id, const char* data, size_t bytes) {
+    FILE* fout=files.getFile(local);
+    if(fout==NULL) {
+      std::cerr<<"Error opening file #"<< id << std::endl;
+      return 9;
+    }
+    if((overwritable && fseeko(fout, 0, SEEK_END) != 0) || fwrite(data, 1, bytes, fout) != bytes) {
+      std::cerr<< "Error writing to file #"<<id<<std::endl;
+      return 10;
+    }
+    return 0;
+  }
+
+  int overwrite(size_t local, size_t id, uint64_t offset, const char* data, size_t bytes) {
+    FILE* fout=files.getFile(local);
+    if(fout==NULL) {
+      std::cerr<<"Error opening file #"<< id << std::endl;
+      return 9;
+    }
+    if(fseeko(fout, headerbytes+offset, SEEK_SET) != 0 || fwrite(data, 1, bytes, fout) != bytes) {
+      std::cerr<< "Error writing to file #"<<id<<std::endl;
+      return 10;
+    }
+    return 0;
+  }
+
+  void close() {
+    files.closeAll();
+  }
+
+protected:
+  CachingFileArray files;
+  bool overwritable;
+  size_t headerbytes;
 };
 
-int compute_and_output_context(const boost::circular_buffer<int>& context, const std::vector<float>& idfs, const arma::fmat& origvects, CachingFileArray& outfiles,unsigned int vecdim, unsigned int contextsize, int prune) {
+/*
+ * Appends the contexts of all the words to one temporary run file,
+ * remembering where the pieces of each word are, so that they can be
+ * gathered into a packed store at the end.
+ */
+class RunContextSink: public ContextSink {
+public:
+  RunContextSink(const std::string& path, size_t numwords): path(path), run(NULL), end(0), segments(numwords) {
+  }
+
+  ~RunContextSink() {
+    close();
+  }
+
+  int append(size_t local, size_t id, const char* data, size_t bytes) {
+    if(run==NULL && (run=fopen(path.c_str(), "w+b"))==NULL) {
+      std::cerr<<"Error opening " << path << std::endl;
+      return 9;
+    }
+    if(fseeko(run, end, SEEK_SET) != 0 || fwrite(data, 1, bytes, run) != bytes) {
+      std::cerr<< "Error writing contexts of word #"<<id<<" to "<<path<<std::endl;
+      return 10;
+    }
+    std::vector<Segment>& word=segments[local];
+    if(!word.empty() && word.back().offset+word.back().bytes==end) {
+      word.back().bytes+=bytes;
+    } else {
+      word.push_back(Segment{end, bytes});
+    }
+    end+=bytes;
+    return 0;
+  }
+
+  int overwrite(size_t local, size_t id, uint64_t offset, const char* data, size_t bytes) {
+    for(const Segment& segment: segments[local]) {
+      if(offset<segment.bytes) {
+	if(fseeko(run, segment.offset+offset, SEEK_SET) != 0 || fwrite(data, 1, bytes, run) != bytes) {
+	  std::cerr<< "Error writing contexts of word #"<<id<<" to "<<path<<std::endl;
+	  return 10;
+	}
+	return 0;
+      }
+      offset-=segment.bytes;
+    }
+    return 0;
+  }
+
+  //Copies the contexts of word local to store, reading through buffer.  Returns 0 on success
+  int copyTo(size_t local, size_t id, ContextStoreWriter& store, std::vector<char>& buffer) {
+    for(const Segment& segment: segments[local]) {
+      if(fseeko(run, segment.offset, SEEK_SET) != 0) {
+	std::cerr<< "Error reading contexts of word #"<<id<<" from "<<path<<std::endl;
+	return 10;
+      }
+      for(uint64_t done=0; done<segment.bytes; ) {
+	size_t n=std::min<uint64_t>(buffer.size(), segment.bytes-done);
+	if(fread(buffer.data(), 1, n, run) != n) {
+	  std::cerr<< "Error reading contexts of word #"<<id<<" from "<<path<<std::endl;
+	  return 10;
+	}
+	store.write(buffer.data(), n);
+	done+=n;
+      }
+    }
+    std::vector<Segment>().swap(segments[local]);
+    return 0;
+  }
+
+  //Deletes the run file
+  void close() {
+    if(run!=NULL) {
+      fclose(run);
+      run=NULL;
+      remove(path.c_str());
+    }
+  }
+
+protected:
+  struct Segment {
+    uint64_t offset;
+    uint64_t bytes;
+  };
+  std::string path;
+  FILE* run;
+  uint64_t end;
+  std::vector<std::vector<Segment> > segments;
+};
+
+/*
+ * Buffers the contexts of each word in memory and writes them out in
+ * large blocks, either when the word's bucket reaches MAX_BUCKET_BYTES or
+ * when all the buffered contexts exceed the memory budget.  The word ids
+ * are split over several independently locked stripes, so that threads
+ * writing contexts of different words rarely contend.
+ *
+ * The contexts are stored in the given encoding, either appended to one
+ * N.vectors file per word, or, if packed, to one run file per stripe.
+ * The runs are gathered into a packed context store by finish().
+ *
+ * If maxcontexts is not 0, each word keeps a uniform sample of at most
+ * maxcontexts of its contexts: those with the smallest priorities, where
+ * a context's priority is a hash of the seed, the word and the context's
+ * position in the corpus.  Once a word's reservoir is full, a context
+ * with a smaller priority than the largest kept one replaces it, either
+ * in the bucket or in place in the file.  So the sample does not depend on
+ * the order in which the contexts arrive, though its order in the output
+ * does.
+ */
+class BufferedContextWriter {
+public:
+  BufferedContextWriter(const std::string& outdir, size_t numwords, size_t vecdim, ContextEncoding encoding, bool packed, size_t cachesize, size_t numstripes, size_t budget, uint64_t maxcontexts, uint64_t seed): outdir(outdir), numwords(numwords), vecdim(vecdim), encoding(encoding), recordbytes(context_record_bytes(encoding, vecdim)), packed(packed), maxcontexts(maxcontexts), seed(seed) {
+    for(size_t s=0; s<numstripes; s++) {
+      size_t stripewords=numwords/numstripes + (s<numwords%numstripes?1:0);
+      std::unique_ptr<ContextSink> sink;
+      if(packed) {
+	sink.reset(new RunContextSink(outdir+"/contexts.run."+std::to_string(s), stripewords));
+      } else {
+	sink.reset(new FileContextSink([outdir, s, numstripes](size_t i) {
+	      std::ostringstream name;
+	      name<<outdir<<"/"<< i*numstripes+s << ".vectors";
+	      return name.str();
+	    }, stripewords, std::max<size_t>(1,cachesize/numstripes), maxcontexts!=0, context_file_header(encoding, vecdim)));
+      }
+      stripes.emplace_back(new Stripe(std::move(sink), stripewords, budget/numstripes, recordbytes, maxcontexts!=0));
+    }
+  }
+
+  //Adds a context of word id, found at the given position in the corpus.  Returns 0 on success
+  int write(size_t id, const float* data, uint64_t position) {
+    Stripe& stripe=*stripes[id%stripes.size()];
+    size_t local=id/stripes.size();
+    std::lock_guard<std::mutex> guard(stripe.lock);
+
+    uint64_t seen=stripe.seen[local]++;
+    if(maxcontexts) {
+      uint64_t priority=mix_hash(seed^mix_hash(id^mix_hash(position)));
+      std::vector<Reserved>& reservoir=stripe.reservoirs[local];
+      if(seen>=maxcontexts) {
+	if(priority>=reservoir.front().first) {
+	  return 0;
+	}
+	std::pop_heap(reservoir.begin(), reservoir.end());
+	uint64_t slot=reservoir.back().second;
+	reservoir.back().first=priority;
+	std::push_heap(reservoir.begin(), reservoir.end());
+	return overwrite(stripe, local, id, slot, data);
+      }
+      reservoir.emplace_back(priority, seen);
+      std::push_heap(reservoir.begin(), reservoir.end());
+    }
+
+    std::vector<char>& bucket=stripe.buckets[local];
+    size_t oldcapacity=bucket.capacity();
+    bucket.resize(bucket.size()+recordbytes);
+    encode_context(encoding, data, vecdim, &bucket[bucket.size()-recordbytes]);
+    stripe.used+=bucket.capacity()-oldcapacity;
+
+    if(bucket.size() >= MAX_BUCKET_BYTES) {
+      return flushBucket(stripe, local, id);
+    }
+    if(stripe.used > stripe.budget) {
+      return flushStripe(stripe, id%stripes.size());
+    }
+    return 0;
+  }
+
+  //Writes out everything still buffered, and builds the packed store.  Returns 0 on success
+  int finish() {
+    if(!packed) {
+      for(size_t s=0; s<stripes.size(); s++) {
+	std::lock_guard<std::mutex> guard(stripes[s]->lock);
+	int retcode=flushStripe(*stripes[s], s);
+	if(retcode) return retcode;
+	stripes[s]->sink->close();
+      }
+      return 0;
+    }
+
+    try {
+      ContextStoreWriter store(outdir, encoding, vecdim);
+      std::vector<char> buffer(MAX_BUCKET_BYTES);
+      for(size_t id=0; id<numwords; id++) {
+	Stripe& stripe=*stripes[id%stripes.size()];
+	size_t local=id/stripes.size();
+	std::lock_guard<std::mutex> guard(stripe.lock);
+	store.beginWord(id);
+	int retcode=static_cast<RunContextSink&>(*stripe.sink).copyTo(local, id, store, buffer);
+	if(retcode) return retcode;
+	store.write(stripe.buckets[local].data(), stripe.buckets[local].size());
+	std::vector<char>().swap(stripe.buckets[local]);
+      }
+      store.close();
+    } catch(std::runtime_error& e) {
+      std::cerr << "Error: " << e.what() << "\n";
+      return 11;
+    }
+    for(std::unique_ptr<Stripe>& stripe: stripes) {
+      stripe->sink->close();
+    }
+    return 0;
+  }
+
+  //Number of contexts of word id seen so far, including those not sampled
+  uint64_t occurrences(size_t id) {
+    Stripe& stripe=*stripes[id%stripes.size()];
+    std::lock_guard<std::mutex> guard(stripe.lock);
+    return stripe.seen[id/stripes.size()];
+  }
+
+protected:
+  //The priority of a kept context and its slot among the word's contexts
+  typedef std::pair<uint64_t, uint64_t> Reserved;
+
+  struct Stripe {
+    Stripe(std::unique_ptr<ContextSink> sink, size_t numwords, size_t budget, size_t recordbytes, bool sampled): sink(std::move(sink)), buckets(numwords), seen(numwords), written(numwords), reservoirs(sampled?numwords:0), record(recordbytes), used(0), budget(budget) {
+    }
+    std::mutex lock;
+    std::unique_ptr<ContextSink> sink;
+    std::vector<std::vector<char> > buckets;
+    //Contexts seen and contexts already written out, per word
+    std::vector<uint64_t> seen;
+    std::vector<uint64_t> written;
+    //Max-heaps of the kept contexts by priority, per word, when sampling
+    std::vector<std::vector<Reserved> > reservoirs;
+    //Scratch space for encoding a context written in place
+    std::vector<char> record;
+    size_t used;
+    size_t budget;
+  };
+
+  //Replaces context number slot of word id
+  int overwrite(Stripe& stripe, size_t local, size_t id, uint64_t slot, const float* data) {
+    if(slot>=stripe.written[local]) {
+      encode_context(encoding, data, vecdim, &stripe.buckets[local][(slot-stripe.written[local])*recordbytes]);
+      return 0;
+    }
+    encode_context(encoding, data, vecdim, stripe.record.data());
+    return stripe.sink->overwrite(local, id, slot*recordbytes, stripe.record.data(), recordbytes);
+  }
+
+  int flushBucket(Stripe& stripe, size_t local, size_t id) {
+    std::vector<char>& bucket=stripe.buckets[local];
+    int retcode=stripe.sink->append(local, id, bucket.data(), bucket.size());
+    if(retcode) return retcode;
+    stripe.written[local]+=bucket.size()/recordbytes;
+    bucket.clear();
+    return 0;
+  }
+
+  //Writes out every bucket of the stripe in word order and releases their memory
+  int flushStripe(Stripe& stripe, size_t s) {
+    for(size_t local=0; local<stripe.buckets.size(); local++) {
+      if(stripe.buckets[local].empty()) {
+	continue;
+      }
+      int retcode=flushBucket(stripe, local, local*stripes.size()+s);
+      if(retcode) return retcode;
+      std::vector<char>().swap(stripe.buckets[local]);
+    }
+    stripe.used=0;
+    return 0;
+  }
+
+  std::string outdir;
+  size_t numwords;
+  size_t vecdim;
+  ContextEncoding encoding;
+  size_t recordbytes;
+  bool packed;
+  uint64_t maxcontexts;
+  uint64_t seed;
+  std::vector<std::unique_ptr<Stripe> > stripes;
+};
+
+int compute_and_output_context(ContextWindow& context, BufferedContextWriter& outfiles, arma::fvec& out, unsigned int vecdim, unsigned int contextsize, int prune, uint64_t position) {
 	int midid=context[contextsize]; 
 	if(midid>=prune) {
 		return 0;
 	}
-	arma::fvec out(vecdim,arma::fill::zeros);
-	compute_context(context, idfs,origvects,out,vecdim,contextsize);
+	context.compute(out);
 
-	FILE* fout=outfiles.getFile(midid);
-	
-	if(fout==NULL) {
-	  std::cerr<<"Error opening file #"<< midid << std::endl;
-	  return 9;
-	}				    
-
-	//now tot will contain the context representation of the middle vector
-	size_t n = fwrite(out.memptr(),sizeof(float),vecdim, fout);
-	if(n != vecdim) {
-	  std::cerr<< "Error writing to file #"<<midid<<std::endl;
-	  return 10;
-	}
-	
-	return 0;
+	//now out will contain the context representation of the middle vector
+	return outfiles.write(midid, out.memptr(), position);
 }
 
-int extract_contexts(std::ifstream& vocabstream, std::ifstream& tfidfstream, std::ifstream& vectorstream, std::string indir, std::string outdir, int vecdim, unsigned int contextsize, std::string eodmarker, std::string ssmarker, std::string esmarker, bool preindexed, std::string oovtoken, boost::optional<const std::string&> digit_rep, unsigned int prune, unsigned int fcachesize) {
-  boost::unordered_map<std::string, int> vocabmap;
-  std::vector<std::string> vocab;
-  std::vector<float> idfs;
-  arma::fmat origvects(vecdim,5);
-	
-  std::string word;
-  unsigned int index=0;
-  while(getline(vocabstream,word)) {
-    vocab.push_back(word);
-    vocabmap[word]=index;
-
-    float tf;
-    tfidfstream >>tf;
-    idfs.push_back(tf);
-
-    if(index>=origvects.n_cols) {
-      origvects.resize(origvects.n_rows,origvects.n_cols*2);
+int extract_chunk(const CorpusChunk& chunk, size_t chunkindex, const Vocabulary& vocab, const std::vector<float>& idfs, const arma::fmat& origvects, BufferedContextWriter& outfiles, unsigned int vecdim, unsigned int contextsize, const std::string& eodmarker, int startdoci, int enddoci, bool preindexed, int oovi, boost::optional<const std::string&> digit_rep, unsigned int vsize) {
+  //Keeps track of the accumulated contexts of the previous 5 words, the current word, and the next 5 words
+  ContextWindow context(idfs, origvects, contextsize);
+  arma::fvec out(vecdim);
+  //A chunk of CORPUS_CHUNK_BYTES has fewer than 2^32 positions, so the
+  //chunk index and the position within it make a unique position
+  uint64_t position=(uint64_t)chunkindex<<32;
+  auto emit=[&](ContextWindow& context) {
+    return compute_and_output_context(context, outfiles, out, vecdim, contextsize, vsize, position++);
+  };
+
+  try {
+    if(chunk.indexed) {
+      IndexedCorpusFile corpus(chunk.path, vocab.size(), vocab.hash());
+      IndexedTokenSource source(corpus, chunk.begin, chunk.end);
+      return walk_contexts(source, context, contextsize, startdoci, enddoci, emit);
     }
-		
-    for(int i=0; i<vecdim; i++) {
-      vectorstream>>origvects(i,index);
+
+    std::ifstream corpusreader(chunk.path.c_str());
+    if(!corpusreader.good()) {
+      return 7;
     }
-    index++;
+    TextTokenSource source(corpusreader, chunk.begin, chunk.end, vocab, eodmarker, preindexed, oovi, digit_rep);
+    return walk_contexts(source, context, contextsize, startdoci, enddoci, emit);
+  } catch(std::invalid_argument& e) {
+    std::cerr<<"Error, non-numerical line found in indexed corpus.\n  Please make sure your corpus is in the right format.\n";
+    return 9;
+  } catch(std::out_of_range& e) {
+    std::cerr << "Error, found out of bounds index in indexed file.\n";
+    return 10;
+  } catch(std::runtime_error& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 11;
   }
+}
 
-  vocabstream.close();
-  tfidfstream.close();
-  vectorstream.close();
+int extract_contexts(const WordModel& model, std::string indir, std::string outdir, unsigned int contextsize, std::string eodmarker, std::string ssmarker, std::string esmarker, bool preindexed, std::string oovtoken, boost::optional<const std::string&> digit_rep, unsigned int prune, unsigned int fcachesize, unsigned int numthreads, size_t buffermem, uint64_t maxcontexts, uint64_t seed, ContextEncoding encoding, bool packed) {
+  const Vocabulary& vocab=model.vocab;
+  const std::vector<float>& idfs=model.idfs;
+  const arma::fmat& origvects=model.vectors();
+  unsigned int vecdim=model.dim;
 
   int oovi=0, startdoci, enddoci;
 
   if(!preindexed) {
     try {
-      oovi = vocabmap.at(oovtoken);
+      oovi = vocab.at(oovtoken);
     } catch(std::out_of_range& e) {
       std::cerr<<"Error: OOV Token is not in the vocabulary in indexing mode\n";
       return 4;
     }
   }
   try {
-    startdoci = vocabmap.at(ssmarker);
+    startdoci = vocab.at(ssmarker);
   } catch(std::out_of_range& e) {
     std::cerr<<"Error: Start of sentence fill token is not in the vocabulary.\n";
     return 5;
   }
   try {
-    enddoci = vocabmap.at(esmarker);
+    enddoci = vocab.at(esmarker);
   } catch(std::out_of_range& e) {
     std::cerr<<"Error: End of sentence fill token is not in the vocabulary.\n";
     return 6;
@@ -202,91 +553,70 @@ int extract_contexts(std::ifstream& vocabstream, std::ifstream& tfidfstream, std
     vsize=prune;
   }
   if(fcachesize==0) {
-    fcachesize=vsize;
-  }
-  //set limit of open files high enough to open a file for every word in the dictionary.
-  rlimit lim;
-  lim.rlim_cur=fcachesize+1024; //1024 extra files just to be safe;
-  lim.rlim_max=fcachesize+1024;
-  setrlimit(RLIMIT_NOFILE , &lim);
-
-  CachingFileArray outfiles(
-			    [&outdir](size_t i) {
-			      std::ostringstream s;
-			      s<<outdir<<"/"<< i << ".vectors";
-			      return s.str();
-			    },
-			    vsize, fcachesize);
+    fcachesize=std::min<size_t>(vsize, DEFAULT_FCACHESIZE);
+  }
+  if(!packed) {
+    //set limit of open files high enough for the file cache.
+    rlimit lim;
+    lim.rlim_cur=fcachesize+1024; //1024 extra files just to be safe;
+    lim.rlim_max=fcachesize+1024;
+    setrlimit(RLIMIT_NOFILE , &lim);
+  }
+
+  BufferedContextWriter outfiles(outdir, vsize, vecdim, encoding, packed, fcachesize, numthreads, buffermem, maxcontexts, seed);
 
+  std::vector<CorpusChunk> chunks;
   try {
-    for (boost::filesystem::directory_iterator itr(indir); itr!=boost::filesystem::directory_iterator(); ++itr) {
-      std::string path=itr->path().string();
-      if(!boost::algorithm::ends_with(path,".txt")) {
-	continue;
-      }
+    chunks=list_corpus_chunks(indir, eodmarker, CORPUS_CHUNK_BYTES);
+  } catch(std::runtime_error& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 11;
+  }
 
-      std::ifstream corpusreader(path.c_str());
-      if(!corpusreader.good()) {
-	return 7;
+  //Each worker takes the next unprocessed chunk until they are all done or one fails
+  std::atomic<size_t> nextchunk(0);
+  std::atomic<int> result(0);
+  std::mutex printlock;
+  auto worker=[&]() {
+    size_t c;
+    while(result==0 && (c=nextchunk++)<chunks.size()) {
+      if(chunks[c].begin==0) {
+	std::lock_guard<std::mutex> guard(printlock);
+	std::cout << "Reading corpus file " << chunks[c].path << std::endl;
+      }
+      int retcode=extract_chunk(chunks[c], c, vocab, idfs, origvects, outfiles, vecdim, contextsize, eodmarker, startdoci, enddoci, preindexed, oovi, digit_rep, vsize);
+      if(retcode) {
+	result=retcode;
       }
-
-      std::cout << "Reading corpus file " << path << std::endl;
-
-      //Keeps track of the accumulated contexts of the previous 5 words, the current word, and the next 5 words
-      boost::circular_buffer<int> context(2*contextsize+1);
-
-      do {
-	context.clear();
-	for(unsigned int i=0; i<contextsize; i++) {
-	  context.push_back(startdoci);
-	}
-	std::string word;
-	for(unsigned int i=0; i<contextsize; i++) {
-	  if(getline(corpusreader,word)) {
-	    if(word == eodmarker) goto EOD;
-	    int wind = lookup_word(vocabmap, word, preindexed, oovi, digit_rep);
-	    context.push_back(wind);
-	  }
-	}
-
-	while(getline(corpusreader,word)) {
-	  if(word == eodmarker) goto EOD;
-	  int newind = lookup_word(vocabmap, word, preindexed, oovi, digit_rep);
-	  context.push_back(newind);
-	  int retcode = compute_and_output_context(context, idfs, origvects,outfiles,vecdim,contextsize,vsize);
-	  if(retcode) return retcode;
-			  
-	  context.pop_front();
-	}
-      EOD:
-	unsigned int k=0;
-	while(context.size()<2*contextsize+1) {
-	  context.push_back(enddoci);
-	  k++;
-	}
-	for(; k<contextsize; k++) {
-	  int retcode = compute_and_output_context(context, idfs, origvects,outfiles,vecdim,contextsize,vsize);
-	  if(retcode) return retcode;
-		    
-	  context.pop_front();
-	  context.push_back(enddoci);
-	}
-      } while(!corpusreader.eof());
     }
-  } catch(std::invalid_argument& e) {
-    std::cerr<<"Error, non-numerical line found in indexed corpus.\n  Please make sure your corpus is in the right format.\n";
-    return 9;
-  } catch(std::out_of_range& e) {
-    std::cerr << "Error, found out of bounds index in indexed file.\n";
-    return 10;
-  }  
+  };
+
+  std::vector<std::thread> threads;
+  for(unsigned int t=1; t<numthreads; t++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for(std::thread& t: threads) {
+    t.join();
+  }
+  if(result) {
+    return result;
+  }
 
   std::cout << "Closing files" <<std::endl;
-  /*
-  // Not necessary, since exiting properly will clean up anyway (And is much faster)
-  outfiles.closeAll();
-  */
-	
+  int retcode=outfiles.finish();
+  if(retcode) {
+    return retcode;
+  }
+
+  std::ofstream occurrencesfile(outdir+"/"+OCCURRENCES_FILE);
+  for(unsigned int i=0; i<vsize; i++) {
+    occurrencesfile << outfiles.occurrences(i) << '\n';
+  }
+  if(!occurrencesfile.good()) {
+    std::cerr << "Error writing the occurrences file\n";
+    return 12;
+  }
   return 0;
 }
 
@@ -296,27 +626,40 @@ int main(int argc, char** argv) {
   std::string vocabf;
   std::string idff;
   std::string vecf;
+  std::string modelf;
   std::string corpusd;
   std::string outd;
-  int dim;
+  unsigned int dim;
   unsigned int contextsize;
   std::string ssmarker, esmarker, eod;
   std::string oovtoken, digit_rep;
   unsigned int prune=0;
   unsigned int fcachesize=0;
+  unsigned int numthreads=1;
+  size_t buffermem;
+  uint64_t maxcontexts=0;
+  uint64_t seed;
+  std::string encodingname;
   po::options_description desc("CExtractContexts Options");
   desc.add_options()
     ("help,h", "produce help message")
-    ("vocab,v", po::value<std::string>(&vocabf)->value_name("<filename>")->required(), "vocab file")
-    ("idf,i", po::value<std::string>(&idff)->value_name("<filename>")->required(), "idf file")
-    ("vec,w", po::value<std::string>(&vecf)->value_name("<filename>")->required(), "word vectors file")
+    ("vocab,v", po::value<std::string>(&vocabf)->value_name("<filename>"), "vocab file")
+    ("idf,i", po::value<std::string>(&idff)->value_name("<filename>"), "idf file")
+    ("vec,w", po::value<std::string>(&vecf)->value_name("<filename>"), "word vectors file")
     ("corpus,c", po::value<std::string>(&corpusd)->value_name("<directory>")->required(), "corpus directory")
     ("outdir,o", po::value<std::string>(&outd)->value_name("<directory>")->required(), "directory to output contexts")
-    ("dim,d", po::value<int>(&dim)->value_name("<number>")->default_value(50),"word vector dimension")
+    ("dim,d", po::value<unsigned int>(&dim)->value_name("<number>")->default_value(50),"word vector dimension")
     ("contextsize,s", po::value<unsigned int>(&contextsize)->value_name("<number>")->default_value(5),"size of context (# of words before and after)")
     ("prune,p",po::value<unsigned int>(&prune)->value_name("<number>"),"only output contexts for the first N words in the vocab")
     ("fcachesize,f", po::value<unsigned int>(&fcachesize)->value_name("<number>"), "maximum number of files to open at once")
+    ("buffermem,b", po::value<size_t>(&buffermem)->value_name("<megabytes>")->default_value(1024), "memory for buffering contexts before writing them out")
+    ("threads,t", po::value<unsigned int>(&numthreads)->value_name("<number>")->default_value(1), "number of worker threads")
+    ("max-contexts-per-word", po::value<uint64_t>(&maxcontexts)->value_name("<number>"), "keep a uniform random sample of at most N contexts of each word")
+    ("seed", po::value<uint64_t>(&seed)->value_name("<number>")->default_value(1), "random seed for sampling contexts")
+    ("encoding,e", po::value<std::string>(&encodingname)->value_name("<float|fp16|int8>")->default_value("float"), "encoding of the output contexts")
+    ("store", "write one packed context store instead of a file per word")
     ;
+  add_model_option(desc, &modelf);
   po::options_description markers("Special Token Options");
   add_eod_option(markers, &eod);
   add_context_options(markers, &ssmarker, &esmarker);
@@ -343,25 +686,6 @@ int main(int argc, char** argv) {
     return 1;
   }
 	
-  std::ifstream vocab(vocabf);
-  if(!vocab.good()) {
-    std::cerr << "Vocab file no good" <<std::endl;
-    return 2;
-  }
-
-  std::ifstream frequencies(idff);
-  if(!frequencies.good()) {
-    std::cerr << "Frequencies file no good" <<std::endl;
-    return 3;
-  }
-
-  std::ifstream vectors(vecf);
-  if(!vectors.good()) {
-    std::cerr << "Vectors file no good" <<std::endl;
-    return 4;
-  }
-
-
   if(!boost::filesystem::is_directory(corpusd)) {
     std::cerr << "Input directory does not exist" <<std::endl;
     return 5;
@@ -375,9 +699,18 @@ int main(int argc, char** argv) {
   if(!digit_rep.empty()) {
     digit_rep_arg=digit_rep;
   }
+  if(numthreads==0) {
+    std::cerr << "Error: --threads must be at least 1\n";
+    return 8;
+  }
+  ContextEncoding encoding;
+  if(!parse_context_encoding(encodingname, encoding)) {
+    std::cerr << "Error: unknown encoding " << encodingname << "\n";
+    return 8;
+  }
   bool preindexed=vm.count("preindexed")>0;
   if(preindexed) {
-    if(vm.count("oovtoken")){
+    if(vm.count("oovtoken") && !vm["oovtoken"].defaulted()){
       std::cerr <<"Error: --oovtoken is not applicable in preindexed mode\n";
       return 7;
     }
@@ -387,7 +720,13 @@ int main(int argc, char** argv) {
     }
   }
 
-  return extract_contexts(vocab, frequencies, vectors, corpusd, outd, dim, contextsize, eod, ssmarker, esmarker, preindexed, oovtoken, digit_rep_arg, prune, fcachesize);
+  WordModel model;
+  int retcode=load_word_model(model, modelf, vocabf, idff, vecf, dim, !vm["dim"].defaulted());
+  if(retcode) {
+    return retcode;
+  }
+
+  return extract_contexts(model, corpusd, outd, contextsize, eod, ssmarker, esmarker, preindexed, oovtoken, digit_rep_arg, prune, fcachesize, numthreads, buffermem*1024*1024, maxcontexts, seed, encoding, vm.count("store")>0);
 }
 
 
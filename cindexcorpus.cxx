@@ -26,8 +26,6 @@
 
 #include <boost/filesystem.hpp>
 
-#include <boost/unordered_map.hpp>
-
 #include <boost/filesystem/fstream.hpp>
 #include <boost/program_options.hpp>
 
@@ -36,19 +34,43 @@
 
 #include "common.hpp"
 
-#include <regex>
 
 namespace po=boost::program_options;
 namespace fs=boost::filesystem;
 
+//Writes the words of a binary indexed corpus file as text
+int deindex_binary_file(const Vocabulary& vocab, const fs::path& ipath, const fs::path& opath, const std::string& eodmarker) {
+  IndexedCorpusFile corpus(ipath.string(), vocab.size(), vocab.hash());
+  fs::ofstream corpuswriter(opath);
+  if(!corpuswriter.good()) {
+    return 8;
+  }
+  std::cout << "Reading corpus file " << ipath << std::endl;
+  for(size_t i=0; i<corpus.numtokens; i++) {
+    uint32_t t=corpus.tokens[i];
+    if(t == INDEXED_EOD) {
+      corpuswriter << eodmarker << "\n";
+    } else if(t>=vocab.size()) {
+      throw std::out_of_range("Out of vocab range");
+    } else {
+      corpuswriter << vocab.word(t) << "\n";
+    }
+  }
+  return 0;
+}
+
 int deindex_corpus(fs::ifstream& vocabstream, fs::path& icorpus, fs::path& ocorpus, std::string eodmarker) {
-  std::vector<std::string> vocab;
+  Vocabulary vocab;
+  vocab.load(vocabstream);
   std::string word;
-  while(getline(vocabstream,word)) {
-    vocab.push_back(word);
-  }
   try {
     for (boost::filesystem::directory_iterator itr(icorpus); itr!=boost::filesystem::directory_iterator(); ++itr) {
+      if(itr->path().extension()==".idx") {
+	fs::path opath=ocorpus / itr->path().filename();
+	int retcode=deindex_binary_file(vocab, itr->path(), opath.replace_extension(".txt"), eodmarker);
+	if(retcode) return retcode;
+	continue;
+      }
       if(itr->path().extension()!=".txt") {
 	continue;
       }
@@ -70,7 +92,7 @@ int deindex_corpus(fs::ifstream& vocabstream, fs::path& icorpus, fs::path& ocorp
 	}
 
 	int ind=read_index(word,vocab.size());
-	corpuswriter << vocab[ind]<<"\n";
+	corpuswriter << vocab.word(ind)<<"\n";
       }
     }
   } catch(std::invalid_argument& e) {
@@ -79,27 +101,27 @@ int deindex_corpus(fs::ifstream& vocabstream, fs::path& icorpus, fs::path& ocorp
   } catch(std::out_of_range& e) {
     std::cerr << "Error, found out of bounds index in indexed file.\n";
     return 10;
-  }  
+  } catch(std::runtime_error& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 11;
+  }
   
   return 0;
 }
 
 
 
-int index_corpus(fs::ifstream& vocabstream, fs::path& icorpus, fs::path& ocorpus, const std::string& unktoken, std::string eodmarker, boost::optional<const std::string&> digit_rep) {
-  std::vector<std::string> vocab;
-  boost::unordered_map<std::string, int> vocabmap;
-  
+//Number of ids buffered before being written out in binary mode
+const size_t INDEX_BUFFER_TOKENS=1<<20;
+
+int index_corpus(fs::ifstream& vocabstream, fs::path& icorpus, fs::path& ocorpus, const std::string& unktoken, std::string eodmarker, boost::optional<const std::string&> digit_rep, bool binary) {
+  Vocabulary vocab;
+  vocab.load(vocabstream);
   std::string word;
-  int index=0;
-  while(getline(vocabstream,word)) {
-    vocab.push_back(word);
-    vocabmap[word]=index++;
-  }
 
   int oov;
   try {
-    oov = vocabmap.at(unktoken);
+    oov = vocab.at(unktoken);
   } catch(std::out_of_range& e) {
     std::cerr<<"Error: Unknown token marker not in the vocabulary";
     return 6;
@@ -114,19 +136,41 @@ int index_corpus(fs::ifstream& vocabstream, fs::path& icorpus, fs::path& ocorpus
     if(!corpusreader.good()) {
       return 7;
     }
-    fs::ofstream corpuswriter(ocorpus / itr->path().filename());
-    if(!corpusreader.good()) {
+    fs::path outpath=ocorpus / itr->path().filename();
+    if(binary) {
+      outpath.replace_extension(".idx");
+    }
+    fs::ofstream corpuswriter(outpath, binary?std::ios::binary:std::ios::out);
+    if(!corpuswriter.good()) {
       return 8;
     }
     std::cout << "Reading corpus file " << itr->path() << std::endl;
     
+    if(binary) {
+      write_indexed_corpus_header(corpuswriter, vocab.size(), vocab.hash());
+      std::vector<uint32_t> buffer;
+      buffer.reserve(INDEX_BUFFER_TOKENS);
+      while(getline(corpusreader,word)) {
+	if(word == eodmarker) {
+	  buffer.push_back(INDEXED_EOD);
+	} else {
+	  buffer.push_back(lookup_word(vocab, word, false, oov, digit_rep));
+	}
+	if(buffer.size() == INDEX_BUFFER_TOKENS) {
+	  corpuswriter.write((const char*)buffer.data(), buffer.size()*sizeof(uint32_t));
+	  buffer.clear();
+	}
+      }
+      corpuswriter.write((const char*)buffer.data(), buffer.size()*sizeof(uint32_t));
+      continue;
+    }
 
     while(getline(corpusreader,word)) {
       if(word == eodmarker) {
 	corpuswriter << eodmarker <<"\n";
 	continue;
       }
-      int ind = lookup_word(vocabmap, word, false, oov, digit_rep); 
+      int ind = lookup_word(vocab, word, false, oov, digit_rep); 
       corpuswriter << ind<<"\n";
     }
     
@@ -152,6 +196,7 @@ int main(int argc, char** argv) {
     ("help,h", "produce help message")
     ("index,x","run in indexing mode")
     ("deindex,u","run in deindexing mode")
+    ("binary,b","write the indexed corpus as binary .idx files (indexing mode only)")
     ("vocab,v", po::value<std::string>(&vocabf)->value_name("<filename>")->required(), "original vocab file")
     ("icorpus,i", po::value<std::string>(&icorpusf)->value_name("<directory>")->required(), "input corpus")
     ("ocorpus,o", po::value<std::string>(&ocorpusf)->value_name("<directory>")->required(), "output relabeled corpus")
@@ -205,9 +250,9 @@ int main(int argc, char** argv) {
   }
 
   if(vm.count("index")) {
-    return index_corpus(vocab, icorpus, ocorpus, oovtoken, eod, digit_rep_arg);
+    return index_corpus(vocab, icorpus, ocorpus, oovtoken, eod, digit_rep_arg, vm.count("binary")>0);
   } else {
-    if(vm.count("oovtoken")) {
+    if(vm.count("oovtoken") && !vm["oovtoken"].defaulted()) {
       std::cerr << "Error: --oovtoken can only be used in indexing mode\n";
       return 5;
     }
@@ -215,6 +260,10 @@ int main(int argc, char** argv) {
       std::cerr << "Error: --digify can only be used in indexing mode\n";
       return 6;
     }
+    if(vm.count("binary")) {
+      std::cerr << "Error: --binary can only be used in indexing mode\n";
+      return 7;
+    }
     return deindex_corpus(vocab, icorpus, ocorpus, eod);
   }
 
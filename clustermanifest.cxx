@@ -0,0 +1,81 @@
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Jeremy Salwen nor the name of any other
+//    contributor may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "clustermanifest.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+ClusterManifest::ClusterManifest(const std::string& clusterdir) {
+  std::string path=clusterdir+"/"+CLUSTER_MANIFEST_FILE;
+  std::ifstream in(path);
+  std::string line;
+  //A line that does not end in a newline was cut off
+  while(std::getline(in, line) && !in.eof()) {
+    std::istringstream fields(line);
+    size_t word;
+    ManifestEntry entry;
+    if(!(fields >> word >> entry.size >> std::hex >> entry.checksum >> std::dec >> entry.objective >> std::ws)) {
+      continue;
+    }
+    std::getline(fields, entry.parameters);
+    entries[word]=entry;
+  }
+  in.close();
+
+  //Compact the manifest to one line per word, so a cut off line is not appended to
+  bool written=write_file_atomically(path, [this](std::ostream& out) {
+      for(const auto& e: entries) {
+	out << e.first << ' ' << e.second.size << ' ' << std::hex << e.second.checksum << std::dec << ' ' << e.second.objective << ' ' << e.second.parameters << '\n';
+      }
+    });
+  if(!written) {
+    throw std::runtime_error("could not write "+path);
+  }
+  log.open(path, std::ios::app);
+  if(!log) {
+    throw std::runtime_error("could not open "+path);
+  }
+}
+
+bool ClusterManifest::find(size_t word, ManifestEntry& entry) {
+  std::lock_guard<std::mutex> guard(lock);
+  auto it=entries.find(word);
+  if(it==entries.end()) {
+    return false;
+  }
+  entry=it->second;
+  return true;
+}
+
+void ClusterManifest::record(size_t word, const ManifestEntry& entry) {
+  std::lock_guard<std::mutex> guard(lock);
+  entries[word]=entry;
+  log << word << ' ' << entry.size << ' ' << std::hex << entry.checksum << std::dec << ' ' << entry.objective << ' ' << entry.parameters << std::endl;
+}
+
+std::map<size_t, ManifestEntry> ClusterManifest::snapshot() {
+  std::lock_guard<std::mutex> guard(lock);
+  return entries;
+}
@@ -0,0 +1,99 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Jeremy Salwen nor the name of any other
+ *    contributor may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef CLUSTER_MANIFEST_H
+#define CLUSTER_MANIFEST_H
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <fstream>
+#include <cstdint>
+#include <cstdio>
+
+/*
+ * The manifest of a cluster directory records, for each clustered word,
+ * the size and checksum of the contexts it was clustered from, and the
+ * clustering parameters, so that a rerun can skip the words which have
+ * not changed.  It is a text file with one line per word:
+ *
+ *   <word id> <size in bytes> <checksum in hex> <objective> <parameters>
+ *
+ * Lines are appended as words finish, and a later line for a word
+ * replaces an earlier one.
+ */
+const std::string CLUSTER_MANIFEST_FILE="manifest.txt";
+
+struct ManifestEntry {
+  uint64_t size;
+  uint64_t checksum;
+  //The mean squared cosine of the contexts with their centroids, or 0 if there are no centroids
+  double objective;
+  std::string parameters;
+};
+
+class ClusterManifest {
+public:
+  /*
+   * Reads the manifest of a cluster directory, if it has one, and opens it
+   * for appending.  A partial last line, left by an interrupted run, is
+   * dropped.  Throws std::runtime_error if the manifest cannot be written.
+   */
+  ClusterManifest(const std::string& clusterdir);
+
+  //Sets entry to the latest entry of a word, or returns false if it has none
+  bool find(size_t word, ManifestEntry& entry);
+
+  //Records that a word was clustered.  Safe to call from several threads
+  void record(size_t word, const ManifestEntry& entry);
+
+  //A copy of the latest entry of each word
+  std::map<size_t, ManifestEntry> snapshot();
+
+private:
+  std::map<size_t, ManifestEntry> entries;
+  std::ofstream log;
+  std::mutex lock;
+};
+
+/*
+ * Writes a file by writing path.tmp with write(std::ostream&) and then
+ * renaming it over path, so that path is always either the old file or
+ * the complete new one.  Returns false if the file could not be written.
+ */
+template<typename Writer>
+bool write_file_atomically(const std::string& path, Writer write) {
+  std::string temppath=path+".tmp";
+  std::ofstream file(temppath, std::ios::binary);
+  write(file);
+  file.close();
+  if(!file) {
+    std::remove(temppath.c_str());
+    return false;
+  }
+  return std::rename(temppath.c_str(), path.c_str())==0;
+}
+
+#endif
@@ -0,0 +1,155 @@
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Jeremy Salwen nor the name of any other
+//    contributor may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "common.hpp"
+#include "contextstore.hpp"
+
+namespace po=boost::program_options;
+
+/*
+ * Merges the Context Directories of partitioned extraction runs into one
+ * packed store.  The contexts of each word are copied straight from the
+ * inputs to their place in the output, so the data is only written once.
+ */
+int merge_contexts(const std::vector<std::string>& indirs, const std::string& outdir, unsigned int dim) {
+  std::vector<std::unique_ptr<ContextStore> > stores;
+  for(const std::string& dir: indirs) {
+    stores.emplace_back(new ContextStore(dir, dim));
+  }
+  ContextEncoding encoding=stores[0]->contextEncoding();
+  size_t recordbytes=context_record_bytes(encoding, dim);
+  ContextStoreWriter out(outdir, encoding, dim);
+
+  //Walks the sorted word lists of all the inputs together
+  std::vector<size_t> next(stores.size(), 0);
+  for(;;) {
+    size_t id=std::numeric_limits<size_t>::max();
+    for(size_t s=0; s<stores.size(); s++) {
+      if(next[s]<stores[s]->words().size()) {
+	id=std::min(id, stores[s]->words()[next[s]]);
+      }
+    }
+    if(id==std::numeric_limits<size_t>::max()) {
+      break;
+    }
+    out.beginWord(id);
+    for(size_t s=0; s<stores.size(); s++) {
+      if(next[s]>=stores[s]->words().size() || stores[s]->words()[next[s]]!=id) {
+	continue;
+      }
+      std::unique_ptr<WordContexts> contexts=stores[s]->contexts(next[s]);
+      if(contexts->numpoints>0 && contexts->encoding!=encoding) {
+	throw std::runtime_error(stores[s]->name(next[s])+" has a different encoding from "+indirs[0]);
+      }
+      out.write(contexts->records, contexts->numpoints*recordbytes);
+      next[s]++;
+    }
+  }
+  out.close();
+
+  //The occurrence counts are summed, if every input has them
+  std::vector<uint64_t> occurrences;
+  for(const std::string& dir: indirs) {
+    std::ifstream in((boost::filesystem::path(dir) / OCCURRENCES_FILE).string());
+    if(!in.good()) {
+      return 0;
+    }
+    uint64_t count;
+    for(size_t i=0; in >> count; i++) {
+      if(i>=occurrences.size()) {
+	occurrences.push_back(0);
+      }
+      occurrences[i]+=count;
+    }
+  }
+  std::ofstream occurrencesfile((boost::filesystem::path(outdir) / OCCURRENCES_FILE).string());
+  for(uint64_t count: occurrences) {
+    occurrencesfile << count << '\n';
+  }
+  if(!occurrencesfile.good()) {
+    throw std::runtime_error("Error writing the occurrences file");
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> indirs;
+  std::string outdir;
+  unsigned int dim;
+
+  po::options_description desc("CMergeContexts Options");
+  desc.add_options()
+    ("help,h", "produce help message")
+    ("contexts,i", po::value<std::vector<std::string> >(&indirs)->value_name("<directory>")->multitoken()->required(), "context directories to merge")
+    ("output,o", po::value<std::string>(&outdir)->value_name("<directory>")->required(), "directory to write the merged store")
+    ("dim,d", po::value<unsigned int>(&dim)->value_name("<number>")->default_value(50),"word vector dimension")
+    ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << "\n";
+    return 0;
+  }
+  try {
+    po::notify(vm);
+  } catch(po::required_option& exception) {
+    std::cerr << "Error: " << exception.what() << "\n";
+    std::cout << desc << "\n";
+    return 1;
+  }
+
+  if(!boost::filesystem::is_directory(outdir)) {
+    std::cerr << "Output directory does not exist" <<std::endl;
+    return 3;
+  }
+  for(const std::string& dir: indirs) {
+    if(!boost::filesystem::is_directory(dir)) {
+      std::cerr << "Context directory " << dir << " does not exist" <<std::endl;
+      return 2;
+    }
+    if(boost::filesystem::equivalent(dir, outdir)) {
+      std::cerr << "Error: the output directory cannot be one of the inputs" <<std::endl;
+      return 2;
+    }
+  }
+
+  try {
+    return merge_contexts(indirs, outdir, dim);
+  } catch(std::runtime_error& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 4;
+  }
+}
@@ -1,4 +1,13 @@
 #include "common.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <cctype>
+#include <cstring>
+
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+
 namespace po=boost::program_options;
 
 void add_eod_option(boost::program_options::options_description& desc, std::string* eodmarker) {
@@ -18,33 +27,180 @@ void add_indexing_options(po::options_description& desc, std::string* oovtoken,
     ;
 }
 
-static std::regex numregex("[-+]?\\d*\\.?\\d+", std::regex::ECMAScript | std::regex::optimize);
-static std::regex digitregex("\\d", std::regex::ECMAScript | std::regex::optimize);
+void add_model_option(po::options_description& desc, std::string* modelfile) {
+  desc.add_options()
+    ("model,m", po::value<std::string>(modelfile)->value_name("<filename>"), "binary model file, instead of the vocab, idf and vectors files")
+    ;
+}
 
+int load_word_model(WordModel& model, const std::string& modelf, const std::string& vocabf, const std::string& idff, const std::string& vecf, unsigned int dim, bool dimset) {
+  try {
+    if(!modelf.empty()) {
+      model.loadBinary(modelf);
+      if(dimset && model.dim != dim) {
+	std::cerr << "Error: the model has dimension " << model.dim << ", not " << dim << std::endl;
+	return 12;
+      }
+      return 0;
+    }
+    if(vocabf.empty() || idff.empty() || vecf.empty()) {
+      std::cerr << "Error: either a model file or the vocab, idf and vectors files are required" << std::endl;
+      return 1;
+    }
+    std::ifstream vocab(vocabf);
+    if(!vocab.good()) {
+      std::cerr << "Vocab file no good" <<std::endl;
+      return 2;
+    }
+    std::ifstream frequencies(idff);
+    if(!frequencies.good()) {
+      std::cerr << "Frequencies file no good" <<std::endl;
+      return 3;
+    }
+    std::ifstream vectors(vecf);
+    if(!vectors.good()) {
+      std::cerr << "Vectors file no good" <<std::endl;
+      return 4;
+    }
+    model.loadText(vocab, frequencies, vectors, dim);
+  } catch(std::runtime_error& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 12;
+  }
+  return 0;
+}
 
-int read_index(const std::string& index, int vocabsize) {
-  int result=std::stoi(index);
+int read_index(boost::string_ref index, int vocabsize) {
+  //Parses like std::stoi: leading whitespace, an optional sign, and digits
+  size_t i=0;
+  while(i<index.size() && std::isspace((unsigned char)index[i])) {
+    i++;
+  }
+  bool negative=false;
+  if(i<index.size() && (index[i]=='-' || index[i]=='+')) {
+    negative=index[i]=='-';
+    i++;
+  }
+  if(i>=index.size() || !std::isdigit((unsigned char)index[i])) {
+    throw std::invalid_argument("Not an index");
+  }
+  long long result=0;
+  for(; i<index.size() && std::isdigit((unsigned char)index[i]); i++) {
+    result=result*10+(index[i]-'0');
+    if(result>vocabsize) {
+      throw std::out_of_range("Out of vocab range");
+    }
+  }
+  if(negative) {
+    result=-result;
+  }
   if(result<0 || result>=vocabsize) {
     throw std::out_of_range("Out of vocab range");
   }
   return result;
 }
 
-int lookup_word(const boost::unordered_map<std::string, int>& vocabmap, const std::string& word, bool preindexed, int oovind, boost::optional<const std::string&> digit_rep) {
+bool digify_number(boost::string_ref word, const std::string& digit_rep, std::string& digified) {
+  //Matches [-+]?[0-9]*\.?[0-9]+
+  size_t i=0;
+  if(i<word.size() && (word[i]=='-' || word[i]=='+')) {
+    i++;
+  }
+  size_t intdigits=0;
+  while(i<word.size() && std::isdigit((unsigned char)word[i])) {
+    i++;
+    intdigits++;
+  }
+  if(i<word.size() && word[i]=='.') {
+    i++;
+    size_t fracdigits=0;
+    while(i<word.size() && std::isdigit((unsigned char)word[i])) {
+      i++;
+      fracdigits++;
+    }
+    if(fracdigits==0) {
+      return false;
+    }
+  } else if(intdigits==0) {
+    return false;
+  }
+  if(i!=word.size()) {
+    return false;
+  }
+
+  digified.clear();
+  for(char c: word) {
+    if(std::isdigit((unsigned char)c)) {
+      digified+=digit_rep;
+    } else {
+      digified+=c;
+    }
+  }
+  return true;
+}
+
+//Declared weak, so they are only called if the BLAS library defines them
+extern "C" {
+  void openblas_set_num_threads(int) __attribute__((weak));
+  void MKL_Set_Num_Threads(int) __attribute__((weak));
+}
+
+void pin_blas_threads() {
+  if(openblas_set_num_threads) {
+    openblas_set_num_threads(1);
+  }
+  if(MKL_Set_Num_Threads) {
+    MKL_Set_Num_Threads(1);
+  }
+}
+
+uint64_t mix_hash(uint64_t x) {
+  //The splitmix64 finalizer
+  x=(x^(x>>30))*0xBF58476D1CE4E5B9ULL;
+  x=(x^(x>>27))*0x94D049BB133111EBULL;
+  return x^(x>>31);
+}
+
+//Folds whole 8 byte words of data into state
+static uint64_t checksum_words(const char* data, uint64_t numwords, uint64_t state) {
+  for(uint64_t i=0; i<numwords; i++) {
+    uint64_t word;
+    std::memcpy(&word, data+i*8, 8);
+    state=mix_hash(state^word);
+  }
+  return state;
+}
+
+//Folds the last partial word and the length of the first length bytes of data into state
+static uint64_t finish_checksum(const char* data, uint64_t length, uint64_t state) {
+  uint64_t tail=0;
+  std::memcpy(&tail, data+length/8*8, length%8);
+  return mix_hash(state^mix_hash(tail^mix_hash(length)));
+}
+
+uint64_t content_checksum(const char* data, uint64_t size, uint64_t prefix, uint64_t& prefixchecksum) {
+  uint64_t prefixwords=std::min(prefix, size)/8;
+  uint64_t state=checksum_words(data, prefixwords, 0);
+  prefixchecksum=prefix<=size?finish_checksum(data, prefix, state):0;
+  state=checksum_words(data+prefixwords*8, size/8-prefixwords, state);
+  return finish_checksum(data, size, state);
+}
+
+int lookup_word(const Vocabulary& vocab, boost::string_ref word, bool preindexed, int oovind, boost::optional<const std::string&> digit_rep) {
   if(preindexed) {
-    return read_index(word, vocabmap.size());
+    return read_index(word, vocab.size());
   } else {
-    boost::unordered_map<std::string,int>::const_iterator index = vocabmap.find(word);
-    if(index != vocabmap.end()) {
-      return index->second;
+    int index = vocab.find(word);
+    if(index >= 0) {
+      return index;
     }
     
     if(digit_rep.is_initialized()) {
-      if(std::regex_match(word,numregex)) {
-	std::string digified = std::regex_replace(word, digitregex, *digit_rep);
-	index=vocabmap.find(digified);
-	if(index !=vocabmap.end()){
-	  return index->second;
+      thread_local std::string digified;
+      if(digify_number(word, *digit_rep, digified)) {
+	index=vocab.find(digified);
+	if(index >= 0){
+	  return index;
 	}
       }
     }
@@ -53,25 +209,181 @@ int lookup_word(const boost::unordered_map<std::string, int>& vocabmap, const st
 }
 
 void compute_context(const boost::circular_buffer<int>& context, const std::vector<float>& idfs, const arma::fmat&  origvects, arma::fvec& outvec, unsigned int vecdim, unsigned int contextsize) {
+	thread_local std::vector<const float*> cols;
+	thread_local std::vector<float> weights;
 
-	float idfc[2*contextsize+1]; //idf context window
-
-	//Look up the idfs of the words in context
-	std::transform(context.begin(),context.end(),idfc,[&idfs](int c) ->float {return idfs[c];});
-
-	float idfsum=std::accumulate(idfc,&idfc[contextsize],0.0f)+std::accumulate(&idfc[contextsize+1],&idfc[2*contextsize+1],0.0f);
+	float idfsum=0;
+	for(unsigned int i=0; i<2*contextsize+1; i++) {
+		if(i!=contextsize) {
+			idfsum+=idfs[context[i]];
+		}
+	}
 	if(idfsum==0) {
 		return;
 	}
 	float invidfsum=1/idfsum; 
 
-	for(unsigned int i=0; i<contextsize; i++) {
-		float idfterm=idfc[i]*invidfsum;
-		std::transform(outvec.begin(), outvec.end(),origvects.unsafe_col(context[i]).begin(), outvec.begin(),  [idfterm](float f1, float f2) -> float { return f1+f2*idfterm; });
+	cols.clear();
+	weights.clear();
+	for(unsigned int i=0; i<2*contextsize+1; i++) {
+		if(i!=contextsize) {
+			cols.push_back(origvects.colptr(context[i]));
+			weights.push_back(idfs[context[i]]*invidfsum);
+		}
 	}
-	for(unsigned int i=contextsize+1; i<2*contextsize+1; i++) {
-		float idfterm=idfc[i]*invidfsum;
-		std::transform(outvec.begin(), outvec.end(),origvects.unsafe_col(context[i]).begin(), outvec.begin(),  [idfterm](float f1, float f2) -> float { return f1+f2*idfterm; });
+	context_kernels(vecdim).weighted_sum(cols.data(), weights.data(), cols.size(), outvec.memptr(), vecdim);
+}
+
+ContextWindow::ContextWindow(const std::vector<float>& idfs, const arma::fmat& origvects, unsigned int contextsize): idfs(idfs), origvects(origvects), contextsize(contextsize), kernels(context_kernels(origvects.n_rows)), window(2*contextsize+1), sum(origvects.n_rows, arma::fill::zeros), shifts(0) {
+}
+
+void ContextWindow::compute(arma::fvec& out) {
+  if(shifts>=WINDOW_RESUM_INTERVAL) {
+    cols.clear();
+    weights.clear();
+    for(int id: window) {
+      cols.push_back(origvects.colptr(id));
+      weights.push_back(idfs[id]);
+    }
+    sum.zeros();
+    kernels.weighted_sum(cols.data(), weights.data(), cols.size(), sum.memptr(), sum.n_rows);
+    shifts=0;
+  }
+
+  int mid=window[contextsize];
+  float idfsum=0;
+  for(unsigned int i=0; i<window.size(); i++) {
+    if(i!=contextsize) {
+      idfsum+=idfs[window[i]];
+    }
+  }
+  if(idfsum==0) {
+    out.zeros();
+    return;
+  }
+  float invidfsum=1/idfsum;
+  float midterm=idfs[mid];
+  const float* s=sum.memptr();
+  const float* v=origvects.colptr(mid);
+  float* o=out.memptr();
+  for(unsigned int i=0; i<sum.n_rows; i++) {
+    o[i]=(s[i]-midterm*v[i])*invidfsum;
+  }
+}
+
+TextTokenSource::TextTokenSource(std::istream& in, size_t begin, size_t end, const Vocabulary& vocab, const std::string& eodmarker, bool preindexed, int oovind, boost::optional<const std::string&> digit_rep): in(in), pos(begin), end(end), vocab(vocab), eodmarker(eodmarker), preindexed(preindexed), oovind(oovind), digit_rep(digit_rep) {
+  in.seekg(begin);
+}
+
+//Returns the offset just past the first end of document line at or after pos
+static size_t next_document_boundary(std::ifstream& in, size_t pos, size_t filesize, const std::string& eodmarker) {
+  in.clear();
+  in.seekg(pos);
+  std::string line;
+  //We may have landed in the middle of a line
+  if(getline(in,line)) {
+    pos+=line.size()+1;
+  }
+  while(pos<filesize && getline(in,line)) {
+    pos+=line.size()+1;
+    if(line == eodmarker) {
+      return pos;
+    }
+  }
+  return filesize;
+}
+
+uint64_t hash_vocab_word(uint64_t hash, boost::string_ref word) {
+  //FNV-1a over the words, each followed by a newline
+  for(unsigned char c: word) {
+    hash=(hash^c)*1099511628211ULL;
+  }
+  return (hash^'\n')*1099511628211ULL;
+}
+
+bool is_indexed_corpus_path(const std::string& path) {
+  return boost::algorithm::ends_with(path,".idx");
+}
+
+void write_indexed_corpus_header(std::ostream& out, uint32_t vocabsize, uint64_t vocabhash) {
+  IndexedCorpusHeader header;
+  std::copy(INDEXED_CORPUS_MAGIC, INDEXED_CORPUS_MAGIC+8, header.magic);
+  header.version=INDEXED_CORPUS_VERSION;
+  header.vocabsize=vocabsize;
+  header.vocabhash=vocabhash;
+  out.write((const char*)&header, sizeof(header));
+}
+
+IndexedCorpusFile::IndexedCorpusFile(const std::string& path, uint32_t expectedsize, uint64_t expectedhash) {
+  open(path);
+  if(vocabsize != expectedsize || vocabhash != expectedhash) {
+    throw std::runtime_error(path+" was indexed with a different vocabulary");
+  }
+}
+
+IndexedCorpusFile::IndexedCorpusFile(const std::string& path) {
+  open(path);
+}
+
+void IndexedCorpusFile::open(const std::string& path) {
+  if(boost::filesystem::file_size(path)<sizeof(IndexedCorpusHeader)) {
+    throw std::runtime_error(path+" is not an indexed corpus file");
+  }
+  file.open(path);
+  IndexedCorpusHeader header;
+  std::copy(file.data(), file.data()+sizeof(header), (char*)&header);
+  if(!std::equal(INDEXED_CORPUS_MAGIC, INDEXED_CORPUS_MAGIC+8, header.magic) || header.version != INDEXED_CORPUS_VERSION) {
+    throw std::runtime_error(path+" is not an indexed corpus file");
+  }
+  vocabsize=header.vocabsize;
+  vocabhash=header.vocabhash;
+  tokens=(const uint32_t*)(file.data()+sizeof(header));
+  numtokens=(file.size()-sizeof(header))/sizeof(uint32_t);
+}
+
+//Returns the offset just past the first INDEXED_EOD at or after pos
+static size_t next_document_boundary(const IndexedCorpusFile& file, size_t pos) {
+  const uint32_t* eod=std::find(file.tokens+pos, file.tokens+file.numtokens, INDEXED_EOD);
+  return std::min<size_t>(eod-file.tokens+1, file.numtokens);
+}
+
+std::vector<CorpusChunk> list_corpus_chunks(const std::string& corpusdir, const std::string& eodmarker, size_t chunkbytes) {
+  std::vector<std::string> paths;
+  for (boost::filesystem::directory_iterator itr(corpusdir); itr!=boost::filesystem::directory_iterator(); ++itr) {
+    std::string path=itr->path().string();
+    if(boost::algorithm::ends_with(path,".txt") || is_indexed_corpus_path(path)) {
+      paths.push_back(path);
+    }
+  }
+
+  std::vector<CorpusChunk> chunks;
+  for(size_t f=0; f<paths.size(); f++) {
+    if(is_indexed_corpus_path(paths[f])) {
+      IndexedCorpusFile file(paths[f]);
+      size_t chunktokens=std::max<size_t>(1, chunkbytes/sizeof(uint32_t));
+      size_t begin=0;
+      do {
+	size_t end=file.numtokens;
+	if(begin+chunktokens<file.numtokens) {
+	  end=next_document_boundary(file, begin+chunktokens);
 	}
+	chunks.push_back(CorpusChunk{paths[f], f, begin, end, true});
+	begin=end;
+      } while(begin<file.numtokens);
+      continue;
+    }
 
+    size_t filesize=boost::filesystem::file_size(paths[f]);
+    std::ifstream in(paths[f].c_str());
+    size_t begin=0;
+    do {
+      size_t end=filesize;
+      if(begin+chunkbytes<filesize) {
+	end=next_document_boundary(in, begin+chunkbytes, filesize, eodmarker);
+      }
+      chunks.push_back(CorpusChunk{paths[f], f, begin, end, false});
+      begin=end;
+    } while(begin<filesize);
+  }
+  return chunks;
 }
@@ -26,13 +26,22 @@
 #ifndef COMMON_H
 #define COMMON_H
 #include "boost/circular_buffer.hpp"
-#include "boost/unordered_map.hpp"
 #include "boost/optional.hpp"
 #include <boost/program_options.hpp>
-#include <regex>
+#include <istream>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/iostreams/device/mapped_file.hpp>
 
 #include <armadillo>
 
+#include "contextkernels.hpp"
+#include "vocabulary.hpp"
+#include "wordmodel.hpp"
+
 
 enum ClusterAlgos {
   SphericalKMeans,
@@ -43,14 +52,270 @@ enum ClusterAlgos {
 void add_eod_option(boost::program_options::options_description& desc, std::string* eodmarker);
 void add_context_options(boost::program_options::options_description& desc, std::string* ssmarker, std::string* esmarker);
 void add_indexing_options(boost::program_options::options_description& desc, std::string* oovtoken, std::string* digit_rep);
+void add_model_option(boost::program_options::options_description& desc, std::string* modelfile);
+
+/*
+ * Loads the binary model file if modelf is not empty, and otherwise the
+ * text vocab, idf and vectors files.  Prints an error and returns nonzero
+ * if they cannot be read, or if dimset and the model's dimension is not dim.
+ */
+int load_word_model(WordModel& model, const std::string& modelf, const std::string& vocabf, const std::string& idff, const std::string& vecf, unsigned int dim, bool dimset);
+
+
 
+int read_index(boost::string_ref index, int vocabsize);
 
+//If word is a number, sets digified to word with every digit replaced by digit_rep and returns true
+bool digify_number(boost::string_ref word, const std::string& digit_rep, std::string& digified);
 
-int read_index(const std::string& index, int vocabsize);
+int lookup_word(const Vocabulary& vocab, boost::string_ref word, bool preindexed, int oovind, boost::optional<const std::string&> digit_rep);
 
+//Limits the BLAS library armadillo was linked with, if it is OpenBLAS or MKL, to one thread
+void pin_blas_threads();
 
-int lookup_word(const boost::unordered_map<std::string, int>& vocabmap, const std::string& word, bool preindexed, int oovind, boost::optional<const std::string&> digit_rep);
+//Context directory file with the number of contexts of each word, one per line, before any sampling
+const std::string OCCURRENCES_FILE="occurrences.txt";
+
+//Scrambles the bits of x, for deriving reproducible random numbers from a seed
+uint64_t mix_hash(uint64_t x);
+
+/*
+ * Checksums size bytes of data.  Also sets prefixchecksum to the checksum
+ * of the first prefix bytes, which costs nothing extra, or to 0 if prefix
+ * is larger than size.
+ */
+uint64_t content_checksum(const char* data, uint64_t size, uint64_t prefix, uint64_t& prefixchecksum);
 
 void compute_context(const boost::circular_buffer<int>& context, const std::vector<float>& idfs, const arma::fmat&  origvects, arma::fvec& outvec, unsigned int vecdim, unsigned int contextsize);
 
+//Number of window shifts after which ContextWindow recomputes its running sum from scratch
+const unsigned int WINDOW_RESUM_INTERVAL=64;
+
+/*
+ * A sliding window of word ids which keeps the running idf-weighted sum of
+ * the vectors of every word in it, so that moving the window by one word
+ * costs one vector addition and one subtraction instead of a full
+ * recomputation.  The sum is periodically recomputed to bound rounding drift.
+ */
+class ContextWindow {
+public:
+  ContextWindow(const std::vector<float>& idfs, const arma::fmat& origvects, unsigned int contextsize);
+
+  void clear() {
+    window.clear();
+    sum.zeros();
+    shifts=0;
+  }
+  void push_back(int id) {
+    if(window.full()) {
+      pop_front();
+    }
+    window.push_back(id);
+    accumulate(id, 1.0f);
+  }
+  void pop_front() {
+    accumulate(window.front(), -1.0f);
+    window.pop_front();
+    shifts++;
+  }
+  size_t size() const {
+    return window.size();
+  }
+  int operator[](size_t i) const {
+    return window[i];
+  }
+  const boost::circular_buffer<int>& ids() const {
+    return window;
+  }
+
+  //Sets out to the idf-weighted average of the vectors around the middle word
+  void compute(arma::fvec& out);
+
+private:
+  void accumulate(int id, float sign) {
+    kernels.axpy(sign*idfs[id], origvects.colptr(id), sum.memptr(), sum.n_rows);
+  }
+
+  const std::vector<float>& idfs;
+  const arma::fmat& origvects;
+  unsigned int contextsize;
+  ContextKernels kernels;
+  boost::circular_buffer<int> window;
+  arma::fvec sum;
+  unsigned int shifts;
+  std::vector<const float*> cols;
+  std::vector<float> weights;
+};
+
+//Id returned by token sources at an end of document marker
+const int END_OF_DOCUMENT=-1;
+
+//Target size of the document-aligned pieces corpus files are split into for parallel processing
+const size_t CORPUS_CHUNK_BYTES=64*1024*1024;
+
+/*
+ * Binary indexed corpus files (.idx) hold a header followed by one uint32
+ * vocabulary id per token, with INDEXED_EOD marking the end of a document.
+ * The header records the size and a hash of the vocabulary used to index
+ * the corpus, so that it is not read with a different one.
+ */
+const char INDEXED_CORPUS_MAGIC[8]={'C','M','V','I','N','D','E','X'};
+const uint32_t INDEXED_CORPUS_VERSION=1;
+const uint32_t INDEXED_EOD=0xFFFFFFFF;
+const uint64_t VOCAB_HASH_INIT=14695981039346656037ULL;
+
+struct IndexedCorpusHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t vocabsize;
+  uint64_t vocabhash;
+};
+
+//Adds the next vocabulary word to a hash started at VOCAB_HASH_INIT
+uint64_t hash_vocab_word(uint64_t hash, boost::string_ref word);
+
+bool is_indexed_corpus_path(const std::string& path);
+
+//Writes an indexed corpus header to out
+void write_indexed_corpus_header(std::ostream& out, uint32_t vocabsize, uint64_t vocabhash);
+
+//A memory mapped binary indexed corpus file
+class IndexedCorpusFile {
+public:
+  //Throws std::runtime_error if the file is not an indexed corpus or was indexed with a different vocabulary
+  IndexedCorpusFile(const std::string& path, uint32_t vocabsize, uint64_t vocabhash);
+  //Opens the file without checking the vocabulary
+  explicit IndexedCorpusFile(const std::string& path);
+
+  const uint32_t* tokens;
+  size_t numtokens;
+  uint32_t vocabsize;
+  uint64_t vocabhash;
+
+private:
+  void open(const std::string& path);
+  boost::iostreams::mapped_file_source file;
+};
+
+//Reads the tokens [begin,end) of a binary indexed corpus
+class IndexedTokenSource {
+public:
+  IndexedTokenSource(const IndexedCorpusFile& file, size_t begin, size_t end): tokens(file.tokens), vocabsize(file.vocabsize), pos(begin), end(std::min(end, file.numtokens)) {
+  }
+
+  bool next(int& id) {
+    if(pos>=end) {
+      return false;
+    }
+    uint32_t t=tokens[pos++];
+    if(t == INDEXED_EOD) {
+      id=END_OF_DOCUMENT;
+    } else if(t>=vocabsize) {
+      throw std::out_of_range("Out of vocab range");
+    } else {
+      id=t;
+    }
+    return true;
+  }
+
+private:
+  const uint32_t* tokens;
+  uint32_t vocabsize;
+  size_t pos;
+  size_t end;
+};
+
+/*
+ * A piece of a corpus file which starts and ends on a document boundary.
+ * begin and end are byte offsets for text files and token offsets for
+ * binary indexed files.
+ */
+struct CorpusChunk {
+  std::string path;
+  size_t fileindex;
+  size_t begin;
+  size_t end;
+  bool indexed;
+};
+
+std::vector<CorpusChunk> list_corpus_chunks(const std::string& corpusdir, const std::string& eodmarker, size_t chunkbytes);
+
+//Reads the lines of a text corpus chunk and looks them up in the vocabulary
+class TextTokenSource {
+public:
+  TextTokenSource(std::istream& in, size_t begin, size_t end, const Vocabulary& vocab, const std::string& eodmarker, bool preindexed, int oovind, boost::optional<const std::string&> digit_rep);
+
+  bool next(int& id) {
+    if(pos>=end || !getline(in,line)) {
+      return false;
+    }
+    pos+=line.size()+1;
+    if(line == eodmarker) {
+      id=END_OF_DOCUMENT;
+    } else {
+      id=lookup_word(vocab, line, preindexed, oovind, digit_rep);
+    }
+    return true;
+  }
+
+private:
+  std::istream& in;
+  size_t pos;
+  size_t end;
+  std::string line;
+  const Vocabulary& vocab;
+  const std::string& eodmarker;
+  bool preindexed;
+  int oovind;
+  boost::optional<const std::string&> digit_rep;
+};
+
+/*
+ * Slides a context window over every document of a token source and calls
+ * emit(context) for each position, where context[contextsize] is the middle
+ * word.  Documents are padded with startdoci before and enddoci after.
+ * Stops early and returns the first nonzero value returned by emit.
+ */
+template<typename Source, typename Window, typename Emit>
+int walk_contexts(Source& source, Window& context, unsigned int contextsize, int startdoci, int enddoci, Emit emit) {
+  bool more=true;
+  while(more) {
+    context.clear();
+    for(unsigned int i=0; i<contextsize; i++) {
+      context.push_back(startdoci);
+    }
+    int id;
+    unsigned int i=0;
+    for(; i<contextsize; i++) {
+      if(!source.next(id)) {
+	more=false;
+	break;
+      }
+      if(id == END_OF_DOCUMENT) break;
+      context.push_back(id);
+    }
+    if(i==contextsize) {
+      while((more=source.next(id)) && id != END_OF_DOCUMENT) {
+	context.push_back(id);
+	int retcode = emit(context);
+	if(retcode) return retcode;
+	context.pop_front();
+      }
+    }
+
+    unsigned int k=0;
+    while(context.size()<2*contextsize+1) {
+      context.push_back(enddoci);
+      k++;
+    }
+    for(; k<contextsize; k++) {
+      int retcode = emit(context);
+      if(retcode) return retcode;
+      context.pop_front();
+      context.push_back(enddoci);
+    }
+  }
+  return 0;
+}
+
 #endif
@@ -0,0 +1,150 @@
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Jeremy Salwen nor the name of any other
+//    contributor may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "contextfile.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+bool parse_context_encoding(const std::string& name, ContextEncoding& encoding) {
+  if(name=="float") {
+    encoding=EncodingFloat;
+  } else if(name=="fp16") {
+    encoding=EncodingHalf;
+  } else if(name=="int8") {
+    encoding=EncodingInt8;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+size_t context_record_bytes(ContextEncoding encoding, unsigned int dim) {
+  switch(encoding) {
+  case EncodingHalf:
+    return dim*sizeof(uint16_t);
+  case EncodingInt8:
+    return sizeof(float)+dim;
+  default:
+    return dim*sizeof(float);
+  }
+}
+
+std::string context_file_header(ContextEncoding encoding, unsigned int dim) {
+  if(encoding==EncodingFloat) {
+    return std::string();
+  }
+  ContextFileHeader header;
+  std::copy(CONTEXT_FILE_MAGIC, CONTEXT_FILE_MAGIC+8, header.magic);
+  header.encoding=encoding;
+  header.dim=dim;
+  return std::string((const char*)&header, sizeof(header));
+}
+
+uint16_t float_to_half(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  uint16_t sign=(x>>16)&0x8000;
+  uint32_t absx=x&0x7FFFFFFF;
+  if(absx>=0x7F800000) { //infinity or NaN
+    return sign|(absx>0x7F800000?0x7E00:0x7C00);
+  }
+  if(absx>=0x477FF000) { //rounds to more than the largest half
+    return sign|0x7C00;
+  }
+  if(absx<0x38800000) { //subnormal half, in units of 2^-24
+    float a;
+    std::memcpy(&a, &absx, sizeof(a));
+    return sign|(uint16_t)std::nearbyint(a*16777216.0f);
+  }
+  //Rebias the exponent, then round the mantissa to nearest even
+  uint32_t h=absx-(112u<<23);
+  h=(h+0xFFF+((h>>13)&1))>>13;
+  return sign|(uint16_t)h;
+}
+
+float half_to_float(uint16_t h) {
+  uint32_t sign=(uint32_t)(h&0x8000)<<16;
+  uint32_t exponent=(h>>10)&0x1F;
+  uint32_t mantissa=h&0x3FF;
+  if(exponent==0) {
+    float f=mantissa*(1.0f/16777216.0f);
+    return sign?-f:f;
+  }
+  uint32_t x;
+  if(exponent==31) {
+    x=sign|0x7F800000|(mantissa<<13);
+  } else {
+    x=sign|((exponent+112)<<23)|(mantissa<<13);
+  }
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+void encode_context(ContextEncoding encoding, const float* in, unsigned int dim, char* out) {
+  if(encoding==EncodingHalf) {
+    for(unsigned int d=0; d<dim; d++) {
+      uint16_t h=float_to_half(in[d]);
+      std::memcpy(out+d*sizeof(h), &h, sizeof(h));
+    }
+  } else if(encoding==EncodingInt8) {
+    float maxabs=0;
+    for(unsigned int d=0; d<dim; d++) {
+      maxabs=std::max(maxabs, std::fabs(in[d]));
+    }
+    float scale=maxabs/127;
+    float inverse=maxabs>0?127/maxabs:0;
+    std::memcpy(out, &scale, sizeof(scale));
+    for(unsigned int d=0; d<dim; d++) {
+      out[sizeof(scale)+d]=(int8_t)std::max(-127.0f, std::min(127.0f, std::nearbyint(in[d]*inverse)));
+    }
+  } else {
+    std::memcpy(out, in, dim*sizeof(float));
+  }
+}
+
+void decode_contexts(ContextEncoding encoding, const char* in, size_t n, unsigned int dim, float* out) {
+  size_t recordbytes=context_record_bytes(encoding, dim);
+  for(size_t i=0; i<n; i++, in+=recordbytes, out+=dim) {
+    if(encoding==EncodingHalf) {
+      for(unsigned int d=0; d<dim; d++) {
+	uint16_t h;
+	std::memcpy(&h, in+d*sizeof(h), sizeof(h));
+	out[d]=half_to_float(h);
+      }
+    } else if(encoding==EncodingInt8) {
+      float scale;
+      std::memcpy(&scale, in, sizeof(scale));
+      const int8_t* q=(const int8_t*)(in+sizeof(scale));
+      for(unsigned int d=0; d<dim; d++) {
+	out[d]=q[d]*scale;
+      }
+    } else {
+      std::memcpy(out, in, dim*sizeof(float));
+    }
+  }
+}
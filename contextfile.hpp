@@ -0,0 +1,72 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Jeremy Salwen nor the name of any other
+ *    contributor may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef CONTEXT_FILE_H
+#define CONTEXT_FILE_H
+
+#include <string>
+#include <cstdint>
+
+/*
+ * Encodings of the context vectors in a .vectors file.  Float files are
+ * the original format, the raw floats with no header.  Files in the
+ * compact encodings start with a ContextFileHeader.  Half files hold each
+ * vector as IEEE-754 half precision floats.  Int8 files hold each vector
+ * as a float scale followed by one signed byte per dimension, with the
+ * value of a component being its byte times the scale.
+ */
+enum ContextEncoding {
+  EncodingFloat,
+  EncodingHalf,
+  EncodingInt8
+};
+
+const char CONTEXT_FILE_MAGIC[8]={'C','M','V','C','T','X','T','S'};
+
+struct ContextFileHeader {
+  char magic[8];
+  uint32_t encoding;
+  uint32_t dim;
+};
+
+//Parses an encoding name (float, fp16 or int8).  Returns false if it is not one
+bool parse_context_encoding(const std::string& name, ContextEncoding& encoding);
+
+//Size in bytes of one encoded vector
+size_t context_record_bytes(ContextEncoding encoding, unsigned int dim);
+
+//The header at the start of a file with the given encoding, empty for float files
+std::string context_file_header(ContextEncoding encoding, unsigned int dim);
+
+//Writes the encoding of the dim floats at in to out
+void encode_context(ContextEncoding encoding, const float* in, unsigned int dim, char* out);
+
+//Decodes n vectors of dimension dim from in to out
+void decode_contexts(ContextEncoding encoding, const char* in, size_t n, unsigned int dim, float* out);
+
+uint16_t float_to_half(float f);
+float half_to_float(uint16_t h);
+
+#endif
@@ -0,0 +1,359 @@
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Jeremy Salwen nor the name of any other
+//    contributor may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#include "contextkernels.hpp"
+
+#include <algorithm>
+
+#include <immintrin.h>
+
+/*
+ * Each kernel takes the dimension both as a template parameter and as an
+ * argument.  DIM==0 means the dimension is only known at runtime.  For the
+ * specialized dimensions the compiler knows the trip counts, so the
+ * accumulators stay in registers while all the columns are summed.
+ */
+
+template<unsigned int DIM>
+static void weighted_sum_generic(const float* const* cols, const float* weights, unsigned int ncols, float* out, unsigned int dim) {
+  const unsigned int n=DIM?DIM:dim;
+  for(unsigned int j=0; j<ncols; j++) {
+    const float w=weights[j];
+    const float* c=cols[j];
+    for(unsigned int d=0; d<n; d++) {
+      out[d]+=w*c[d];
+    }
+  }
+}
+
+template<unsigned int DIM>
+static void axpy_generic(float a, const float* x, float* y, unsigned int dim) {
+  const unsigned int n=DIM?DIM:dim;
+  for(unsigned int d=0; d<n; d++) {
+    y[d]+=a*x[d];
+  }
+}
+
+template<unsigned int DIM>
+static void dots_generic(const float* m, unsigned int ncols, const float* x, float* out, unsigned int dim) {
+  const unsigned int n=DIM?DIM:dim;
+  for(unsigned int j=0; j<ncols; j++) {
+    const float* c=m+(size_t)j*n;
+    float s=0;
+    for(unsigned int d=0; d<n; d++) {
+      s+=c[d]*x[d];
+    }
+    out[j]=s;
+  }
+}
+
+template<unsigned int DIM>
+static void dots_block_generic(const float* m, unsigned int ncols, const float* const* xs, unsigned int nx, float* out, unsigned int dim) {
+  for(unsigned int i=0; i<nx; i++) {
+    dots_generic<DIM>(m, ncols, xs[i], out+(size_t)i*ncols, dim);
+  }
+}
+
+//Lanes [0,n) are set in masktable+8-n
+static const int masktable[16]={-1,-1,-1,-1,-1,-1,-1,-1,0,0,0,0,0,0,0,0};
+
+//Number of ymm accumulators per pass.  Leaves room for the weight and a load
+const unsigned int AVX2_TILE=12;
+
+template<unsigned int DIM>
+__attribute__((target("avx2,fma")))
+static void weighted_sum_avx2(const float* const* cols, const float* weights, unsigned int ncols, float* out, unsigned int dim) {
+  const unsigned int n=DIM?DIM:dim;
+  const unsigned int nregs=(n+7)/8;
+  const unsigned int tail=n%8;
+  const __m256i tailmask=_mm256_loadu_si256((const __m256i*)(masktable+8-tail));
+
+  for(unsigned int base=0; base<nregs; base+=AVX2_TILE) {
+    const unsigned int r=std::min(AVX2_TILE, nregs-base);
+    const bool partial=tail && base+r==nregs;
+    float* o=out+8*base;
+
+    __m256 acc[AVX2_TILE];
+    for(unsigned int t=0; t<r; t++) {
+      acc[t]=(partial && t==r-1)?_mm256_maskload_ps(o+8*t, tailmask):_mm256_loadu_ps(o+8*t);
+    }
+    for(unsigned int j=0; j<ncols; j++) {
+      const __m256 w=_mm256_set1_ps(weights[j]);
+      const float* c=cols[j]+8*base;
+      for(unsigned int t=0; t<r; t++) {
+	__m256 x=(partial && t==r-1)?_mm256_maskload_ps(c+8*t, tailmask):_mm256_loadu_ps(c+8*t);
+	acc[t]=_mm256_fmadd_ps(w, x, acc[t]);
+      }
+    }
+    for(unsigned int t=0; t<r; t++) {
+      if(partial && t==r-1) {
+	_mm256_maskstore_ps(o+8*t, tailmask, acc[t]);
+      } else {
+	_mm256_storeu_ps(o+8*t, acc[t]);
+      }
+    }
+  }
+}
+
+template<unsigned int DIM>
+__attribute__((target("avx2,fma")))
+static void axpy_avx2(float a, const float* x, float* y, unsigned int dim) {
+  const unsigned int n=DIM?DIM:dim;
+  for(unsigned int d=0; d<n; d++) {
+    y[d]+=a*x[d];
+  }
+}
+
+/*
+ * The dot products of the R vectors xs[r] with each column at m, into
+ * out[r*ncols+j].  A column is loaded once for all R vectors, and each
+ * dot product takes the same steps whatever R is, so the single and the
+ * blocked kernels agree to the bit.
+ */
+template<unsigned int DIM, unsigned int R>
+__attribute__((target("avx2,fma")))
+static void dots_rows_avx2(const float* m, unsigned int ncols, const float* const* xs, float* out, unsigned int dim) {
+  const unsigned int n=DIM?DIM:dim;
+  const unsigned int full=n/8;
+  const unsigned int tail=n%8;
+  const __m256i tailmask=_mm256_loadu_si256((const __m256i*)(masktable+8-tail));
+
+  for(unsigned int j=0; j<ncols; j++) {
+    const float* c=m+(size_t)j*n;
+    //Two accumulators per vector, to overlap the latency of the fmas
+    __m256 acc0[R], acc1[R];
+    for(unsigned int r=0; r<R; r++) {
+      acc0[r]=_mm256_setzero_ps();
+      acc1[r]=_mm256_setzero_ps();
+    }
+    unsigned int t=0;
+    for(; t+1<full; t+=2) {
+      const __m256 c0=_mm256_loadu_ps(c+8*t), c1=_mm256_loadu_ps(c+8*t+8);
+      for(unsigned int r=0; r<R; r++) {
+	acc0[r]=_mm256_fmadd_ps(c0, _mm256_loadu_ps(xs[r]+8*t), acc0[r]);
+	acc1[r]=_mm256_fmadd_ps(c1, _mm256_loadu_ps(xs[r]+8*t+8), acc1[r]);
+      }
+    }
+    if(t<full) {
+      const __m256 c0=_mm256_loadu_ps(c+8*t);
+      for(unsigned int r=0; r<R; r++) {
+	acc0[r]=_mm256_fmadd_ps(c0, _mm256_loadu_ps(xs[r]+8*t), acc0[r]);
+      }
+    }
+    if(tail) {
+      const __m256 c0=_mm256_maskload_ps(c+8*full, tailmask);
+      for(unsigned int r=0; r<R; r++) {
+	acc1[r]=_mm256_fmadd_ps(c0, _mm256_maskload_ps(xs[r]+8*full, tailmask), acc1[r]);
+      }
+    }
+    for(unsigned int r=0; r<R; r++) {
+      __m256 acc=_mm256_add_ps(acc0[r], acc1[r]);
+      __m128 sum=_mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+      sum=_mm_hadd_ps(sum, sum);
+      sum=_mm_hadd_ps(sum, sum);
+      out[(size_t)r*ncols+j]=_mm_cvtss_f32(sum);
+    }
+  }
+}
+
+//Vectors per pass of the blocked kernel: two accumulators each, and two column registers
+const unsigned int AVX2_DOTS_ROWS=4;
+
+template<unsigned int DIM>
+__attribute__((target("avx2,fma")))
+static void dots_avx2(const float* m, unsigned int ncols, const float* x, float* out, unsigned int dim) {
+  dots_rows_avx2<DIM, 1>(m, ncols, &x, out, dim);
+}
+
+template<unsigned int DIM>
+__attribute__((target("avx2,fma")))
+static void dots_block_avx2(const float* m, unsigned int ncols, const float* const* xs, unsigned int nx, float* out, unsigned int dim) {
+  unsigned int i=0;
+  for(; i+AVX2_DOTS_ROWS<=nx; i+=AVX2_DOTS_ROWS) {
+    dots_rows_avx2<DIM, AVX2_DOTS_ROWS>(m, ncols, xs+i, out+(size_t)i*ncols, dim);
+  }
+  for(; i<nx; i++) {
+    dots_rows_avx2<DIM, 1>(m, ncols, xs+i, out+(size_t)i*ncols, dim);
+  }
+}
+
+//Number of zmm accumulators per pass.  24 covers 300 dimensions in one pass
+const unsigned int AVX512_TILE=24;
+
+template<unsigned int DIM>
+__attribute__((target("avx512f")))
+static void weighted_sum_avx512(const float* const* cols, const float* weights, unsigned int ncols, float* out, unsigned int dim) {
+  const unsigned int n=DIM?DIM:dim;
+  const unsigned int nregs=(n+15)/16;
+  const unsigned int tail=n%16;
+  const __mmask16 tailmask=(__mmask16)((1u<<tail)-1);
+
+  for(unsigned int base=0; base<nregs; base+=AVX512_TILE) {
+    const unsigned int r=std::min(AVX512_TILE, nregs-base);
+    const bool partial=tail && base+r==nregs;
+    float* o=out+16*base;
+
+    __m512 acc[AVX512_TILE];
+    for(unsigned int t=0; t<r; t++) {
+      acc[t]=(partial && t==r-1)?_mm512_maskz_loadu_ps(tailmask, o+16*t):_mm512_loadu_ps(o+16*t);
+    }
+    for(unsigned int j=0; j<ncols; j++) {
+      const __m512 w=_mm512_set1_ps(weights[j]);
+      const float* c=cols[j]+16*base;
+      for(unsigned int t=0; t<r; t++) {
+	__m512 x=(partial && t==r-1)?_mm512_maskz_loadu_ps(tailmask, c+16*t):_mm512_loadu_ps(c+16*t);
+	acc[t]=_mm512_fmadd_ps(w, x, acc[t]);
+      }
+    }
+    for(unsigned int t=0; t<r; t++) {
+      if(partial && t==r-1) {
+	_mm512_mask_storeu_ps(o+16*t, tailmask, acc[t]);
+      } else {
+	_mm512_storeu_ps(o+16*t, acc[t]);
+      }
+    }
+  }
+}
+
+template<unsigned int DIM>
+__attribute__((target("avx512f")))
+static void axpy_avx512(float a, const float* x, float* y, unsigned int dim) {
+  const unsigned int n=DIM?DIM:dim;
+  for(unsigned int d=0; d<n; d++) {
+    y[d]+=a*x[d];
+  }
+}
+
+//dots_rows_avx2 with zmm registers
+template<unsigned int DIM, unsigned int R>
+__attribute__((target("avx512f")))
+static void dots_rows_avx512(const float* m, unsigned int ncols, const float* const* xs, float* out, unsigned int dim) {
+  const unsigned int n=DIM?DIM:dim;
+  const unsigned int full=n/16;
+  const unsigned int tail=n%16;
+  const __mmask16 tailmask=(__mmask16)((1u<<tail)-1);
+
+  for(unsigned int j=0; j<ncols; j++) {
+    const float* c=m+(size_t)j*n;
+    __m512 acc0[R], acc1[R];
+    for(unsigned int r=0; r<R; r++) {
+      acc0[r]=_mm512_setzero_ps();
+      acc1[r]=_mm512_setzero_ps();
+    }
+    unsigned int t=0;
+    for(; t+1<full; t+=2) {
+      const __m512 c0=_mm512_loadu_ps(c+16*t), c1=_mm512_loadu_ps(c+16*t+16);
+      for(unsigned int r=0; r<R; r++) {
+	acc0[r]=_mm512_fmadd_ps(c0, _mm512_loadu_ps(xs[r]+16*t), acc0[r]);
+	acc1[r]=_mm512_fmadd_ps(c1, _mm512_loadu_ps(xs[r]+16*t+16), acc1[r]);
+      }
+    }
+    if(t<full) {
+      const __m512 c0=_mm512_loadu_ps(c+16*t);
+      for(unsigned int r=0; r<R; r++) {
+	acc0[r]=_mm512_fmadd_ps(c0, _mm512_loadu_ps(xs[r]+16*t), acc0[r]);
+      }
+    }
+    if(tail) {
+      const __m512 c0=_mm512_maskz_loadu_ps(tailmask, c+16*full);
+      for(unsigned int r=0; r<R; r++) {
+	acc1[r]=_mm512_fmadd_ps(c0, _mm512_maskz_loadu_ps(tailmask, xs[r]+16*full), acc1[r]);
+      }
+    }
+    for(unsigned int r=0; r<R; r++) {
+      //Reduced by hand through two 256-bit halves; the extract intrinsics and
+      //_mm512_reduce_add_ps trip -Wmaybe-uninitialized in GCC's own headers
+      alignas(64) float lanes[16];
+      _mm512_store_ps(lanes, _mm512_add_ps(acc0[r], acc1[r]));
+      __m256 half=_mm256_add_ps(_mm256_load_ps(lanes), _mm256_load_ps(lanes+8));
+      __m128 sum=_mm_add_ps(_mm256_castps256_ps128(half), _mm256_extractf128_ps(half, 1));
+      sum=_mm_hadd_ps(sum, sum);
+      sum=_mm_hadd_ps(sum, sum);
+      out[(size_t)r*ncols+j]=_mm_cvtss_f32(sum);
+    }
+  }
+}
+
+//Vectors per pass of the blocked kernel, with twice as many registers as AVX2
+const unsigned int AVX512_DOTS_ROWS=8;
+
+template<unsigned int DIM>
+__attribute__((target("avx512f")))
+static void dots_avx512(const float* m, unsigned int ncols, const float* x, float* out, unsigned int dim) {
+  dots_rows_avx512<DIM, 1>(m, ncols, &x, out, dim);
+}
+
+template<unsigned int DIM>
+__attribute__((target("avx512f")))
+static void dots_block_avx512(const float* m, unsigned int ncols, const float* const* xs, unsigned int nx, float* out, unsigned int dim) {
+  unsigned int i=0;
+  for(; i+AVX512_DOTS_ROWS<=nx; i+=AVX512_DOTS_ROWS) {
+    dots_rows_avx512<DIM, AVX512_DOTS_ROWS>(m, ncols, xs+i, out+(size_t)i*ncols, dim);
+  }
+  for(; i<nx; i++) {
+    dots_rows_avx512<DIM, 1>(m, ncols, xs+i, out+(size_t)i*ncols, dim);
+  }
+}
+
+template<unsigned int DIM>
+static ContextKernels kernels_for(KernelISA isa) {
+  switch(isa) {
+  case ISAAVX512:
+    return ContextKernels{weighted_sum_avx512<DIM>, axpy_avx512<DIM>, dots_avx512<DIM>, dots_block_avx512<DIM>};
+  case ISAAVX2:
+    return ContextKernels{weighted_sum_avx2<DIM>, axpy_avx2<DIM>, dots_avx2<DIM>, dots_block_avx2<DIM>};
+  default:
+    return ContextKernels{weighted_sum_generic<DIM>, axpy_generic<DIM>, dots_generic<DIM>, dots_block_generic<DIM>};
+  }
+}
+
+KernelISA detect_kernel_isa() {
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f")) {
+    return ISAAVX512;
+  }
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return ISAAVX2;
+  }
+  return ISAGeneric;
+}
+
+ContextKernels select_context_kernels(unsigned int dim, KernelISA isa) {
+  switch(dim) {
+  case 50:
+    return kernels_for<50>(isa);
+  case 100:
+    return kernels_for<100>(isa);
+  case 200:
+    return kernels_for<200>(isa);
+  case 300:
+    return kernels_for<300>(isa);
+  default:
+    return kernels_for<0>(isa);
+  }
+}
+
+ContextKernels context_kernels(unsigned int dim) {
+  static const KernelISA isa=detect_kernel_isa();
+  return select_context_kernels(dim, isa);
+}
@@ -0,0 +1,74 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Jeremy Salwen nor the name of any other
+ *    contributor may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef CONTEXT_KERNELS_H
+#define CONTEXT_KERNELS_H
+
+/*
+ * Vector kernels used to build context representations.  There are
+ * versions specialized for the common word vector dimensions (50, 100, 200
+ * and 300) and a generic one, each with AVX-512, AVX2/FMA and plain C++
+ * implementations.  The best one for the running CPU is picked at runtime.
+ */
+
+enum KernelISA {
+  ISAGeneric,
+  ISAAVX2,
+  ISAAVX512
+};
+
+//out[d] += sum over j of weights[j]*cols[j][d]
+typedef void (*WeightedSumKernel)(const float* const* cols, const float* weights, unsigned int ncols, float* out, unsigned int dim);
+
+//y[d] += a*x[d]
+typedef void (*AxpyKernel)(float a, const float* x, float* y, unsigned int dim);
+
+//out[j] = the dot product of x with the jth of ncols vectors stored one after another at m
+typedef void (*DotsKernel)(const float* m, unsigned int ncols, const float* x, float* out, unsigned int dim);
+
+/*
+ * out[i*ncols+j] = the dot product of xs[i] with the jth of ncols vectors
+ * stored one after another at m, for each of nx vectors xs[i].  Each dot
+ * product is summed exactly as DotsKernel sums it.
+ */
+typedef void (*DotsBlockKernel)(const float* m, unsigned int ncols, const float* const* xs, unsigned int nx, float* out, unsigned int dim);
+
+struct ContextKernels {
+  WeightedSumKernel weighted_sum;
+  AxpyKernel axpy;
+  DotsKernel dots;
+  DotsBlockKernel dots_block;
+};
+
+//The most capable instruction set supported by this CPU
+KernelISA detect_kernel_isa();
+
+//The kernels for vectors of dimension dim using the given instruction set
+ContextKernels select_context_kernels(unsigned int dim, KernelISA isa);
+
+//The kernels for vectors of dimension dim on this CPU
+ContextKernels context_kernels(unsigned int dim);
+
+#endif
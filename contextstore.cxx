@@ -0,0 +1,204 @@
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Jeremy Salwen nor the name of any other
+//    contributor may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "contextstore.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+
+WordContexts::WordContexts(const char* records, size_t numpoints, ContextEncoding encoding, unsigned int dim): records(records), numpoints(numpoints), encoding(encoding), dim(dim) {
+}
+
+WordContexts::WordContexts(const std::string& path, unsigned int dim): records(NULL), numpoints(0), encoding(EncodingFloat), dim(dim) {
+  if(boost::filesystem::file_size(path)==0) {
+    return;
+  }
+  file.open(path);
+  records=file.data();
+  size_t size=file.size();
+  if(size>=sizeof(ContextFileHeader) && std::equal(CONTEXT_FILE_MAGIC, CONTEXT_FILE_MAGIC+8, records)) {
+    ContextFileHeader header;
+    std::memcpy(&header, records, sizeof(header));
+    if(header.dim!=dim) {
+      throw std::runtime_error(path+" has contexts of dimension "+std::to_string(header.dim)+", not "+std::to_string(dim));
+    }
+    if(header.encoding!=EncodingHalf && header.encoding!=EncodingInt8) {
+      throw std::runtime_error(path+" has an unknown encoding");
+    }
+    encoding=(ContextEncoding)header.encoding;
+    records+=sizeof(header);
+    size-=sizeof(header);
+  }
+  numpoints=size/context_record_bytes(encoding, dim);
+}
+
+const arma::fmat& WordContexts::points() {
+  if(!data) {
+    if(encoding==EncodingFloat) {
+      data.reset(new arma::fmat((float*)records, dim, numpoints, false, true));
+    } else {
+      data.reset(new arma::fmat(dim, numpoints));
+      decode_contexts(encoding, records, numpoints, dim, data->memptr());
+    }
+  }
+  return *data;
+}
+
+ContextStore::ContextStore(const std::string& dir, unsigned int dim): dir(dir), dim(dim), encoding(EncodingFloat) {
+  boost::filesystem::path indexpath=boost::filesystem::path(dir) / CONTEXT_STORE_INDEX_FILE;
+  packed=boost::filesystem::exists(indexpath);
+  if(!packed) {
+    for(boost::filesystem::directory_iterator itr(dir); itr!=boost::filesystem::directory_iterator(); ++itr) {
+      std::string name=itr->path().filename().string();
+      if(!boost::algorithm::ends_with(name, ".vectors")) {
+	continue;
+      }
+      std::string stem=itr->path().stem().string();
+      if(stem.empty() || stem.find_first_not_of("0123456789")!=std::string::npos) {
+	continue;
+      }
+      wordids.push_back(std::stoul(stem));
+    }
+    std::sort(wordids.begin(), wordids.end());
+    return;
+  }
+
+  std::ifstream index(indexpath.string(), std::ios::binary);
+  ContextStoreHeader header;
+  if(!index.read((char*)&header, sizeof(header)) || !std::equal(CONTEXT_STORE_MAGIC, CONTEXT_STORE_MAGIC+8, header.magic) || header.version!=CONTEXT_STORE_VERSION) {
+    throw std::runtime_error(indexpath.string()+" is not a context store index");
+  }
+  if(header.dim!=dim) {
+    throw std::runtime_error(dir+" has contexts of dimension "+std::to_string(header.dim)+", not "+std::to_string(dim));
+  }
+  if(header.encoding>EncodingInt8) {
+    throw std::runtime_error(dir+" has an unknown encoding");
+  }
+  encoding=(ContextEncoding)header.encoding;
+  entries.resize(header.numwords);
+  if(!index.read((char*)entries.data(), entries.size()*sizeof(ContextStoreEntry))) {
+    throw std::runtime_error(indexpath.string()+" is truncated");
+  }
+
+  std::string storepath=(boost::filesystem::path(dir) / CONTEXT_STORE_FILE).string();
+  uint64_t storesize=boost::filesystem::file_size(storepath);
+  size_t recordbytes=context_record_bytes(encoding, dim);
+  for(const ContextStoreEntry& e: entries) {
+    if(e.offset+e.count*recordbytes > storesize) {
+      throw std::runtime_error(storepath+" is truncated");
+    }
+    wordids.push_back(e.word);
+  }
+  if(storesize>0) {
+    store.open(storepath);
+  }
+}
+
+std::unique_ptr<WordContexts> ContextStore::contexts(size_t i) const {
+  if(packed) {
+    const ContextStoreEntry& e=entries[i];
+    return std::unique_ptr<WordContexts>(new WordContexts(store.data()+e.offset, e.count, encoding, dim));
+  }
+  return std::unique_ptr<WordContexts>(new WordContexts(name(i), dim));
+}
+
+uint64_t ContextStore::size(size_t i) const {
+  if(packed) {
+    return entries[i].count*context_record_bytes(encoding, dim);
+  }
+  return boost::filesystem::file_size(name(i));
+}
+
+ContextEncoding ContextStore::contextEncoding() const {
+  if(packed || wordids.empty()) {
+    return encoding;
+  }
+  return contexts(0)->encoding;
+}
+
+std::string ContextStore::name(size_t i) const {
+  if(packed) {
+    return (boost::filesystem::path(dir) / CONTEXT_STORE_FILE).string()+" word "+std::to_string(wordids[i]);
+  }
+  return (boost::filesystem::path(dir) / (std::to_string(wordids[i])+".vectors")).string();
+}
+
+ContextStoreWriter::ContextStoreWriter(const std::string& dir, ContextEncoding encoding, unsigned int dim): dir(dir), offset(0), recordbytes(context_record_bytes(encoding, dim)) {
+  boost::filesystem::remove(boost::filesystem::path(dir) / CONTEXT_STORE_INDEX_FILE);
+  std::string storepath=(boost::filesystem::path(dir) / CONTEXT_STORE_FILE).string();
+  store.open(storepath, std::ios::binary);
+  if(!store.good()) {
+    throw std::runtime_error("Could not open "+storepath);
+  }
+  std::copy(CONTEXT_STORE_MAGIC, CONTEXT_STORE_MAGIC+8, header.magic);
+  header.version=CONTEXT_STORE_VERSION;
+  header.encoding=encoding;
+  header.dim=dim;
+  header.reserved=0;
+  header.numwords=0;
+}
+
+void ContextStoreWriter::beginWord(size_t id) {
+  if(!entries.empty() && entries.back().count==0) {
+    entries.pop_back();
+  }
+  const char padding[CONTEXT_STORE_ALIGNMENT]={0};
+  uint64_t aligned=(offset+CONTEXT_STORE_ALIGNMENT-1)/CONTEXT_STORE_ALIGNMENT*CONTEXT_STORE_ALIGNMENT;
+  store.write(padding, aligned-offset);
+  offset=aligned;
+  ContextStoreEntry e;
+  e.word=id;
+  e.offset=offset;
+  e.count=0;
+  entries.push_back(e);
+}
+
+void ContextStoreWriter::write(const char* records, size_t bytes) {
+  store.write(records, bytes);
+  offset+=bytes;
+  entries.back().count+=bytes/recordbytes;
+  if(!store.good()) {
+    throw std::runtime_error("Error writing the context store in "+dir);
+  }
+}
+
+void ContextStoreWriter::close() {
+  if(!entries.empty() && entries.back().count==0) {
+    entries.pop_back();
+  }
+  store.close();
+  //The index is written last, so an interrupted run does not leave a store that looks complete
+  std::string indexpath=(boost::filesystem::path(dir) / CONTEXT_STORE_INDEX_FILE).string();
+  std::ofstream index(indexpath, std::ios::binary);
+  header.numwords=entries.size();
+  index.write((const char*)&header, sizeof(header));
+  index.write((const char*)entries.data(), entries.size()*sizeof(ContextStoreEntry));
+  if(store.fail() || !index.good()) {
+    throw std::runtime_error("Error writing the context store in "+dir);
+  }
+}
@@ -0,0 +1,161 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Jeremy Salwen nor the name of any other
+ *    contributor may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef CONTEXT_STORE_H
+#define CONTEXT_STORE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <cstdint>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <armadillo>
+
+#include "contextfile.hpp"
+
+/*
+ * A packed context store keeps the contexts of all the words in one data
+ * file, CONTEXT_STORE_FILE, with the contexts of each word contiguous and
+ * starting on a CONTEXT_STORE_ALIGNMENT byte boundary.  The index file,
+ * CONTEXT_STORE_INDEX_FILE, holds a ContextStoreHeader followed by one
+ * ContextStoreEntry per word with contexts, in increasing word order.
+ */
+const std::string CONTEXT_STORE_FILE="contexts.store";
+const std::string CONTEXT_STORE_INDEX_FILE="contexts.index";
+const char CONTEXT_STORE_MAGIC[8]={'C','M','V','S','T','O','R','E'};
+const uint32_t CONTEXT_STORE_VERSION=1;
+const uint64_t CONTEXT_STORE_ALIGNMENT=64;
+
+struct ContextStoreHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t encoding;
+  uint32_t dim;
+  uint32_t reserved;
+  uint64_t numwords;
+};
+
+struct ContextStoreEntry {
+  uint64_t word;
+  //Byte offset of the contexts in the data file, and their number
+  uint64_t offset;
+  uint64_t count;
+};
+
+/*
+ * The contexts of one word.  Float contexts are used in place, and
+ * compact encodings are decoded when the points are first requested.
+ */
+class WordContexts {
+public:
+  //Contexts in memory owned by someone else
+  WordContexts(const char* records, size_t numpoints, ContextEncoding encoding, unsigned int dim);
+
+  /*
+   * Memory maps a .vectors file.  Throws std::runtime_error if the file's
+   * header does not match dim.
+   */
+  WordContexts(const std::string& path, unsigned int dim);
+
+  //The contexts as the columns of a matrix
+  const arma::fmat& points();
+
+  const char* records;
+  size_t numpoints;
+  ContextEncoding encoding;
+
+private:
+  boost::iostreams::mapped_file_source file;
+  unsigned int dim;
+  std::unique_ptr<arma::fmat> data;
+};
+
+/*
+ * The contexts of a Context Directory, read from its packed store if it
+ * has one, and otherwise from its N.vectors files.  Throws
+ * std::runtime_error if the store does not match dim.
+ */
+class ContextStore {
+public:
+  ContextStore(const std::string& dir, unsigned int dim);
+
+  //The ids of the words with contexts, in increasing order
+  const std::vector<size_t>& words() const {
+    return wordids;
+  }
+
+  //The contexts of the ith word of words().  Safe to call from several threads
+  std::unique_ptr<WordContexts> contexts(size_t i) const;
+
+  //The size in bytes of the contexts of the ith word
+  uint64_t size(size_t i) const;
+
+  //The encoding of the contexts, taken from the first file if they are not packed
+  ContextEncoding contextEncoding() const;
+
+  //The .vectors file of the ith word, or its place in the packed store, for messages
+  std::string name(size_t i) const;
+
+  bool packed;
+
+private:
+  std::string dir;
+  unsigned int dim;
+  std::vector<size_t> wordids;
+  std::vector<ContextStoreEntry> entries;
+  ContextEncoding encoding;
+  boost::iostreams::mapped_file_source store;
+};
+
+/*
+ * Writes a packed store into a directory, one word at a time in
+ * increasing word order.  Throws std::runtime_error if it cannot write.
+ */
+class ContextStoreWriter {
+public:
+  ContextStoreWriter(const std::string& dir, ContextEncoding encoding, unsigned int dim);
+
+  //Starts the contexts of word id
+  void beginWord(size_t id);
+
+  //Adds encoded contexts to the current word
+  void write(const char* records, size_t bytes);
+
+  //Writes the index
+  void close();
+
+private:
+  std::string dir;
+  std::ofstream store;
+  uint64_t offset;
+  size_t recordbytes;
+  ContextStoreHeader header;
+  std::vector<ContextStoreEntry> entries;
+};
+
+#endif
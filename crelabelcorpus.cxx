@@ -23,18 +23,28 @@
 // ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <iostream>
 #include <sstream>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <unordered_map>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string/predicate.hpp>
-#include <boost/unordered_map.hpp>
 #include <boost/circular_buffer.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/program_options.hpp>
 
-#include "mlpack/cosinesqrkernel.hpp"
 #include <armadillo>
 
 #include "common.hpp"
+#include "centersfile.hpp"
+#include "contextkernels.hpp"
 
 #ifdef ENABLE_HALITE
 #include "Classifier.h"
@@ -45,50 +55,351 @@ namespace hl=Halite;
 namespace po=boost::program_options;
 namespace fs=boost::filesystem;
 
+/*
+ * Corpus files are relabeled in document-aligned chunks of about this
+ * many bytes.  Each chunk's output is held in memory until the chunks
+ * before it are written, so they are smaller than for extraction.
+ */
+const size_t RELABEL_CHUNK_BYTES=8*1024*1024;
 
 
+
+/*
+ * Assigns each token to the sense whose center has the largest squared
+ * cosine with its context.  The centers are scaled to unit norm once they
+ * are all read, and the senses of a word are consecutive columns, so a
+ * token costs one small matrix-vector product and an argmax.
+ */
 class SphericalKMeansClassifier {
 public:
-  SphericalKMeansClassifier(size_t vecdim): numcenters(0), centers(vecdim,5) {
+  //Space for the context of a token and its similarities, one per thread
+  struct Scratch {
+    Scratch(const SphericalKMeansClassifier& classifier): context(classifier.centers.n_rows), sims(classifier.maxsenses) {
+    }
+    arma::fvec context;
+    std::vector<float> sims;
+  };
+
+  /*
+   * Tokens labeled together.  Their contexts are added in corpus order,
+   * and classify then groups them by word, so that the senses of each
+   * word are ranked for all its tokens with one blocked kernel call.
+   */
+  struct Batch {
+    Batch(const SphericalKMeansClassifier& classifier, size_t capacity): contexts(classifier.centers.n_rows, capacity), sims(classifier.maxsenses*capacity), capacity(capacity), size(0), numcontexts(0) {
+      words.reserve(capacity);
+      meanings.reserve(capacity);
+      tokens.reserve(capacity);
+      order.reserve(capacity);
+      rows.reserve(capacity);
+    }
+    void clear() {
+      size=0;
+      numcontexts=0;
+      words.clear();
+      meanings.clear();
+      tokens.clear();
+    }
+
+    //The contexts of the tokens with more than one sense, and the token each belongs to
+    arma::fmat contexts;
+    std::vector<size_t> tokens;
+    //The word and the sense of every token
+    std::vector<int> words;
+    std::vector<int> meanings;
+
+    std::vector<float> sims;
+    std::vector<size_t> order;
+    //The contexts of one word's tokens, for the blocked kernel
+    std::vector<const float*> rows;
+    size_t capacity;
+    size_t size;
+    size_t numcontexts;
+  };
+
+  SphericalKMeansClassifier(size_t vecdim): numcenters(0), centers(vecdim,5), preloaded(false), maxsenses(0), kernels(context_kernels(vecdim)), sensehash(VOCAB_HASH_INIT) {
   }
 
-  void addCenters(std::string& word, std::string newword, std::ifstream& newvocabstream, std::ifstream& centerstream) {
+  /*
+   * Reads all the centers of a binary centers file at once, after its
+   * header, so that addCenters only has to count them.  Returns false if
+   * the file is short.
+   */
+  bool loadCenters(std::istream& centerstream, uint64_t count) {
+    centers.set_size(centers.n_rows, count);
+    preloaded=true;
+    return (bool)centerstream.read((char*)centers.memptr(), centers.n_elem*sizeof(float));
+  }
+
+  //Adds the centers of word, starting with the one of newword, the line of the expanded vocabulary last read
+  void addCenters(boost::string_ref word, std::string& newword, std::ifstream& newvocabstream, std::ifstream& centerstream) {
 
     crossreference.push_back(numcenters);
     do {
+      sensehash=hash_vocab_word(sensehash, newword);
+      if(preloaded) {
+	numcenters++;
+	continue;
+      }
       if(numcenters>=centers.n_cols) {
 	centers.resize(centers.n_rows,centers.n_cols*2);
       }
       for(unsigned int i=0; i<centers.n_rows; i++) {
 	centerstream >>centers(i,numcenters);
       }
-      getline(newvocabstream, newword);
       numcenters++;
-    } while(newword.substr(3) == word);
+    } while(getline(newvocabstream, newword) && newword.size()>=3 && boost::string_ref(newword).substr(3) == word);
     
   }
-  
-  int convertWord(const boost::circular_buffer<int>& context, const std::vector<float>& idfs, const arma::fmat&  origvects, unsigned int contextsize) {
+
+  /*
+   * Marks the end of the last word's centers, and normalizes them.
+   * Returns false if a binary file had a different number of centers.
+   */
+  bool finishCenters() {
+    crossreference.push_back(numcenters);
+    if(preloaded && numcenters!=centers.n_cols) {
+      return false;
+    }
+    //Zero centers stay zero, and are never closer than another center, as with the cosine
+    for(size_t j=0; j<numcenters; j++) {
+      float* c=centers.colptr(j);
+      double sqnorm=0;
+      for(size_t i=0; i<centers.n_rows; i++) {
+	sqnorm+=(double)c[i]*c[i];
+      }
+      if(sqnorm>0) {
+	float scale=1/std::sqrt(sqnorm);
+	for(size_t i=0; i<centers.n_rows; i++) {
+	  c[i]*=scale;
+	}
+      }
+    }
+    for(size_t w=0; w+1<crossreference.size(); w++) {
+      maxsenses=std::max<size_t>(maxsenses, crossreference[w+1]-crossreference[w]);
+    }
+    return true;
+  }
+
+  int convertWord(ContextWindow& context, unsigned int contextsize, Scratch& scratch) const {
     int index=context[contextsize];
-    arma::fvec c(centers.n_rows, arma::fill::zeros);
-    compute_context(context, idfs, origvects, c, centers.n_rows, contextsize);
     unsigned int starti=crossreference[index];
     unsigned int endi=crossreference[index+1];
+    unsigned int nclust=endi-starti;
+    //Most words have one sense, and need no context
+    if(nclust<=1) {
+      return 0;
+    }
 
-    int nclust=endi-starti;
-    std::vector<float> sim(nclust);
+    context.compute(scratch.context);
+    //The norm of the context is the same for every sense, so the squared dot products rank them like the squared cosines
+    kernels.dots(centers.colptr(starti), nclust, scratch.context.memptr(), scratch.sims.data(), centers.n_rows);
+    return best_sense(scratch.sims.data(), nclust);
+  }
 
-    for(int i=0; i<nclust; i++) {
-      sim[i]=CosineSqrKernel().Evaluate(centers.unsafe_col(starti+i),c);
+  //The index in the expanded vocabulary of a sense of a word
+  uint32_t senseId(int index, int meaning) const {
+    return crossreference[index]+meaning;
+  }
+
+  /*
+   * Formats the line of the relabeled corpus for every sense once, so
+   * that writing a token is a copy.
+   */
+  void formatLabels(const Vocabulary& vocab) {
+    std::ostringstream table;
+    labeloffsets.assign(1, 0);
+    for(size_t index=0; index+1<crossreference.size(); index++) {
+      for(unsigned int meaning=0; meaning<crossreference[index+1]-crossreference[index]; meaning++) {
+	table << std::setfill ('0') << std::setw (3) << meaning << vocab.word(index) << '\n';
+	labeloffsets.push_back(table.tellp());
+      }
+    }
+    labels=table.str();
+  }
+
+  //Appends the line of a sense of a word to out
+  void appendLabel(std::string& out, int index, int meaning) const {
+    size_t id=senseId(index, meaning);
+    out.append(labels, labeloffsets[id], labeloffsets[id+1]-labeloffsets[id]);
+  }
+
+  unsigned int numSenses(int index) const {
+    return crossreference[index+1]-crossreference[index];
+  }
+
+  //Adds a token whose sense is already known to a batch.  Returns true if the batch is then full
+  bool addLabeled(int index, int meaning, Batch& batch) const {
+    batch.words.push_back(index);
+    batch.meanings.push_back(meaning);
+    batch.size++;
+    return batch.size==batch.capacity;
+  }
+
+  //Adds the middle token of context to a batch.  Returns true if the batch is then full
+  bool addWord(ContextWindow& context, unsigned int contextsize, Batch& batch) const {
+    int index=context[contextsize];
+    batch.words.push_back(index);
+    batch.meanings.push_back(0);
+    if(crossreference[index+1]-crossreference[index]>1) {
+      arma::fvec c(batch.contexts.colptr(batch.numcontexts), batch.contexts.n_rows, false, true);
+      context.compute(c);
+      batch.tokens.push_back(batch.size);
+      batch.numcontexts++;
+    }
+    batch.size++;
+    return batch.size==batch.capacity;
+  }
+
+  /*
+   * Sets the sense of every token in a batch.  The blocked kernel reads
+   * each center of a word once for several of its tokens, and sums every
+   * dot product exactly as the single token kernel does, so near ties are
+   * broken the same way whatever the batch size.
+   */
+  void classify(Batch& batch) const {
+    size_t dim=centers.n_rows;
+    std::vector<size_t>& order=batch.order;
+    order.resize(batch.numcontexts);
+    for(size_t i=0; i<order.size(); i++) {
+      order[i]=i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+	return batch.words[batch.tokens[a]]<batch.words[batch.tokens[b]];
+      });
+
+    for(size_t first=0, last; first<order.size(); first=last) {
+      int index=batch.words[batch.tokens[order[first]]];
+      for(last=first+1; last<order.size() && batch.words[batch.tokens[order[last]]]==index; last++);
+      unsigned int starti=crossreference[index];
+      unsigned int nclust=crossreference[index+1]-starti;
+      batch.rows.clear();
+      for(size_t i=first; i<last; i++) {
+	batch.rows.push_back(batch.contexts.colptr(order[i]));
+      }
+      kernels.dots_block(centers.colptr(starti), nclust, batch.rows.data(), batch.rows.size(), batch.sims.data(), dim);
+      for(size_t i=first; i<last; i++) {
+	batch.meanings[batch.tokens[order[i]]]=best_sense(&batch.sims[(i-first)*nclust], nclust);
+      }
     }
-	
-    return distance(sim.begin(), max_element(sim.begin(), sim.end()));
   }
 
 
   std::vector<unsigned int> crossreference;
   size_t numcenters;
   arma::fmat centers;
+  bool preloaded;
+  size_t maxsenses;
+  ContextKernels kernels;
+  //The hash of the expanded vocabulary, as a Vocabulary would compute it
+  uint64_t sensehash;
+
+private:
+  //The sense with the largest squared dot product, the first of any ties
+  static int best_sense(const float* dots, unsigned int nclust) {
+    unsigned int best=0;
+    float bestsim=dots[0]*dots[0];
+    for(unsigned int i=1; i<nclust; i++) {
+      float sim=dots[i]*dots[i];
+      if(sim>bestsim) {
+	best=i;
+	bestsim=sim;
+      }
+    }
+    return best;
+  }
+
+  std::string labels;
+  std::vector<size_t> labeloffsets;
+};
+
+/*
+ * Remembers the senses given to recent context windows, so that a window
+ * which repeats exactly, as in boilerplate text, is not classified again.
+ * Windows are found by a hash of their ids and then compared in full.
+ * At most capacity windows are kept, and the CLOCK policy chooses which
+ * to evict: a hand sweeps over the slots, sparing once each slot that was
+ * used since it last passed.
+ */
+class WindowCache {
+public:
+  WindowCache(size_t capacity, unsigned int windowsize): lookups(0), hits(0), capacity(capacity), windowsize(windowsize), ids(capacity*windowsize), keys(capacity), meanings(capacity), referenced(capacity), used(0), hand(0) {
+    index.reserve(capacity);
+  }
+
+  //Copies the ids of the window of context to window, and returns their hash
+  static uint64_t key(const ContextWindow& context, int* window) {
+    uint64_t hash=0;
+    for(size_t i=0; i<context.size(); i++) {
+      window[i]=context[i];
+      hash=mix_hash(hash^(uint32_t)context[i]);
+    }
+    return hash;
+  }
+
+  //Sets meaning to the sense of a window, if it is cached
+  bool find(const int* window, uint64_t hash, int& meaning) {
+    lookups++;
+    auto it=index.find(hash);
+    if(it==index.end() || !std::equal(window, window+windowsize, &ids[it->second*windowsize])) {
+      return false;
+    }
+    hits++;
+    referenced[it->second]=1;
+    meaning=meanings[it->second];
+    return true;
+  }
+
+  //Caches the sense of a window, replacing any window with the same hash
+  void insert(const int* window, uint64_t hash, int meaning) {
+    auto it=index.find(hash);
+    size_t slot;
+    if(it!=index.end()) {
+      slot=it->second;
+    } else {
+      slot=evict();
+      index.emplace(hash, slot);
+    }
+    std::copy(window, window+windowsize, &ids[slot*windowsize]);
+    keys[slot]=hash;
+    meanings[slot]=meaning;
+    referenced[slot]=0;
+  }
+
+  void clear() {
+    index.clear();
+    used=0;
+    hand=0;
+  }
+
+  uint64_t lookups;
+  uint64_t hits;
+
+private:
+  //A free slot, made by evicting a window once the cache is full
+  size_t evict() {
+    if(used<capacity) {
+      return used++;
+    }
+    while(referenced[hand]) {
+      referenced[hand]=0;
+      hand=(hand+1)%capacity;
+    }
+    size_t slot=hand;
+    hand=(hand+1)%capacity;
+    index.erase(keys[slot]);
+    return slot;
+  }
+
+  size_t capacity;
+  unsigned int windowsize;
+  std::unordered_map<uint64_t, size_t> index;
+  std::vector<int> ids;
+  std::vector<uint64_t> keys;
+  std::vector<int> meanings;
+  std::vector<unsigned char> referenced;
+  size_t used;
+  size_t hand;
 };
 #ifdef ENABLE_HALITE
 class HaliteClassifier {
@@ -125,11 +436,11 @@ public:
       haliteclustersfile>>nextclusteridx;
     }
   }
-  int convertWord(const boost::circular_buffer<int>& context, const std::vector<float>& idfs, const arma::fmat& origvects,  unsigned int contextsize) {
+  int convertWord(ContextWindow& context, unsigned int contextsize) {
     int index=context[contextsize];
   
-    arma::fvec c(vecdim, arma::fill::zeros);
-    compute_context(context, idfs, origvects, c, vecdim, contextsize);
+    arma::fvec c(vecdim);
+    context.compute(c);
     std::cout <<"vector " <<context[contextsize]<<"\n";
     for(size_t i=0; i<c.n_rows; i++)
       std::cout <<c[i] <<", ";
@@ -147,20 +458,17 @@ public:
 };
 #endif
 
-int relabel_corpus(ClusterAlgos format, fs::ifstream& vocabstream,fs::ifstream& newvocabstream,fs::ifstream& idfstream, fs::ifstream& vecstream, fs::ifstream& centerstream, fs::path& icorpus, fs::path& ocorpus, unsigned int vecdim, unsigned int contextsize, std::string eodmarker, std::string ssmarker, std::string esmarker, bool preindexed, std::string oovtoken, boost::optional<const std::string&> digit_rep) {
+int relabel_corpus(ClusterAlgos format, const WordModel& model, fs::ifstream& newvocabstream, fs::ifstream& centerstream, fs::path& icorpus, fs::path& ocorpus, unsigned int contextsize, std::string eodmarker, std::string ssmarker, std::string esmarker, bool preindexed, std::string oovtoken, boost::optional<const std::string&> digit_rep, unsigned int numthreads, size_t batchsize, bool binary, size_t cachesize) {
 
-  boost::unordered_map<std::string, int> vocabmap;
-  std::vector<std::string> vocab;
-  std::vector<float> idfs;
-  arma::fmat origvects(vecdim, 5);
+  const Vocabulary& vocab=model.vocab;
+  const std::vector<float>& idfs=model.idfs;
+  const arma::fmat& origvects=model.vectors();
+  unsigned int vecdim=model.dim;
 
   std::unique_ptr<SphericalKMeansClassifier> kmeans;
 	
 #ifdef ENABLE_HALITE
   std::unique_ptr<HaliteClassifier> halite;
-#else
-  std::cerr<<"Error: Attempted to use Halite clustering format when it was disabled at compile time\n";
-  exit(1);	  
 #endif
 	
   if(format == SphericalKMeans) {
@@ -168,149 +476,306 @@ int relabel_corpus(ClusterAlgos format, fs::ifstream& vocabstream,fs::ifstream&
   } else if(format == HaliteAlgo) {
 #ifdef ENABLE_HALITE
     halite = std::unique_ptr<HaliteClassifier>(new HaliteClassifier(vecdim));
+#else
+    std::cerr<<"Error: Attempted to use Halite clustering format when it was disabled at compile time\n";
+    exit(1);
 #endif
-	  
   }
 
-  unsigned int index=0;
-  std::string word;
   std::string newword;
   getline(newvocabstream,newword);
   int64_t nextclusteridx;
   nextclusteridx=-1;
-  centerstream >> nextclusteridx;
-  while(getline(vocabstream,word)) {
-    vocab.push_back(word);
-    vocabmap[word]=index;
-    
-    float idf;
-    idfstream >> idf;
-    idfs.push_back(idf);
-		
-    if(index>=origvects.n_cols) { 
-      origvects.resize(vecdim, origvects.n_cols*2);
-    }
-    for(unsigned int i=0; i<vecdim; i++) {
-      vecstream >> origvects(i,index);
+  if(format == SphericalKMeans) {
+    //Binary centers, from CExpandVocab --binary, are read in one block
+    CentersFileHeader header;
+    if(read_centers_header(centerstream, header)) {
+      if(header.dim!=vecdim || !kmeans->loadCenters(centerstream, header.numcenters)) {
+	std::cerr << "Error: the centers file does not hold centers of dimension " << vecdim << "\n";
+	return 12;
+      }
     }
+  } else {
+    centerstream >> nextclusteridx;
+  }
+  for(unsigned int index=0; index<vocab.size(); index++) {
     if(format == SphericalKMeans) {
-      kmeans->addCenters(word, newword, newvocabstream, centerstream);
+      kmeans->addCenters(vocab.word(index), newword, newvocabstream, centerstream);
     } else if(format == HaliteAlgo) {
 #ifdef ENABLE_HALITE
       halite->addClusters(index, nextclusteridx, centerstream);
 #endif
     }
-    index++;
+  }
+  if(format == SphericalKMeans && !kmeans->finishCenters()) {
+    std::cerr << "Error: the centers file and the expanded vocabulary have different numbers of centers\n";
+    return 12;
+  }
+  if(format == SphericalKMeans) {
+    kmeans->formatLabels(vocab);
   }
 
   int oovi=0, startdoci, enddoci;
 
   if(!preindexed) {
     try {
-      oovi = vocabmap.at(oovtoken);
+      oovi = vocab.at(oovtoken);
     } catch(std::out_of_range& e) {
       std::cerr<<"Error: OOV token '"<< oovtoken<<"'is not in the vocabulary.\n";
       return 5;
     }
   }
   try {
-    startdoci = vocabmap.at(ssmarker);
+    startdoci = vocab.at(ssmarker);
   } catch(std::out_of_range& e) {
     std::cerr<<"Error: Start of sentence fill marker '"<<ssmarker<<"' is not in the vocabulary.\n";
     return 6;
   }
   try {
-    enddoci = vocabmap.at(esmarker);
+    enddoci = vocab.at(esmarker);
   } catch(std::out_of_range& e) {
     std::cerr<<"Error: End of sentence fill marker '"<<esmarker<<"' is not in the vocabulary.\n";
     return 7;
   }
+  std::vector<CorpusChunk> chunks;
   try {
-    for (boost::filesystem::directory_iterator itr(icorpus); itr!=boost::filesystem::directory_iterator(); ++itr) {
-      if(itr->path().extension()!=".txt") {
-	continue;
-      }
+    chunks=list_corpus_chunks(icorpus.string(), eodmarker, RELABEL_CHUNK_BYTES);
+  } catch(std::runtime_error& e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 11;
+  }
+  //A corpus file is written under its own name with the output extension,
+  //so files that differ only in their extension, like foo.txt and foo.idx,
+  //would overwrite each other
+  std::vector<fs::path> outpaths(chunks.size());
+  std::unordered_map<std::string, std::string> outsources;
+  for(size_t c=0; c<chunks.size(); c++) {
+    if(chunks[c].begin!=0) {
+      continue;
+    }
+    outpaths[c]=(ocorpus / fs::path(chunks[c].path).filename()).replace_extension(binary?".idx":".txt");
+    auto inserted=outsources.emplace(outpaths[c].string(), chunks[c].path);
+    if(!inserted.second) {
+      std::cerr << "Error: " << inserted.first->second << " and " << chunks[c].path << " would both be written to " << outpaths[c].string() << "\n";
+      return 11;
+    }
+  }
 
-      fs::ifstream corpusreader(itr->path());
-      if(!corpusreader.good()) {
-	return 7;
+  //Appends a relabeled token to out, as a line of text or as the uint32 expanded vocabulary id
+  auto append_token=[&](std::string& out, int wid, int meaning) {
+    if(binary) {
+      uint32_t id=kmeans->senseId(wid, meaning);
+      out.append((const char*)&id, sizeof(id));
+    } else if(format == SphericalKMeans) {
+      kmeans->appendLabel(out, wid, meaning);
+    } else {
+      char prefix[16];
+      snprintf(prefix, sizeof(prefix), "%03d", meaning);
+      out.append(prefix);
+      out.append(vocab.word(wid).data(), vocab.word(wid).size());
+      out.push_back('\n');
+    }
+  };
+
+  /*
+   * Relabels one chunk, appending its output to out.  The cache, if any,
+   * starts empty, so that the output does not depend on which thread
+   * relabeled the chunks before.
+   */
+  auto relabel_chunk=[&](const CorpusChunk& chunk, std::string& out, WindowCache* cache) {
+    //Keeps track of the accumulated contexts of the previous 5 words, the current word, and the next 5 words
+    ContextWindow context(idfs, origvects, contextsize);
+    std::vector<int> window(2*contextsize+1);
+    //The windows of the batched tokens not found in the cache, to add once they are labeled
+    std::vector<int> pendingwindows;
+    std::vector<uint64_t> pendingkeys;
+    if(cache) {
+      cache->clear();
+    }
+    std::unique_ptr<SphericalKMeansClassifier::Scratch> scratch;
+    std::unique_ptr<SphericalKMeansClassifier::Batch> batch;
+    if(format == SphericalKMeans) {
+      scratch.reset(new SphericalKMeansClassifier::Scratch(*kmeans));
+      if(batchsize) {
+	batch.reset(new SphericalKMeansClassifier::Batch(*kmeans, batchsize));
       }
-      fs::ofstream corpuswriter(ocorpus / itr->path().filename());
-      if(!corpusreader.good()) {
-	return 8;
+    }
+    auto flush=[&]() {
+      kmeans->classify(*batch);
+      for(size_t i=0; i<batch->size; i++) {
+	append_token(out, batch->words[i], batch->meanings[i]);
       }
-      std::cout << "Reading corpus file " << itr->path() << std::endl;
-
-      //Keeps track of the accumulated contexts of the previous 5 words, the current word, and the next 5 words
-      boost::circular_buffer<int > context(2*contextsize+1);
-
-      do {
-	context.clear();
-	for(unsigned int i=0; i<contextsize; i++) {
-	  context.push_back(startdoci);
-	}
-	std::string word;
-	for(unsigned int i=0; i<contextsize; i++) {
-	  if(getline(corpusreader,word)) {
-	    if(word == eodmarker) goto EOD;
-	    int wind=lookup_word(vocabmap, word, preindexed, oovi, digit_rep);
-
-	    context.push_back(wind);
+      for(size_t j=0; j<pendingkeys.size(); j++) {
+	cache->insert(&pendingwindows[j*window.size()], pendingkeys[j], batch->meanings[batch->tokens[j]]);
+      }
+      pendingwindows.clear();
+      pendingkeys.clear();
+      batch->clear();
+    };
+
+    auto emit=[&](ContextWindow& context) {
+      int wid=context[contextsize];
+      //Only windows around words with several senses are worth caching
+      bool cached=cache && kmeans->numSenses(wid)>1;
+      uint64_t key=0;
+      int meaning=0;
+      if(cached) {
+	key=WindowCache::key(context, window.data());
+	if(cache->find(window.data(), key, meaning)) {
+	  if(!batch) {
+	    append_token(out, wid, meaning);
+	  } else if(kmeans->addLabeled(wid, meaning, *batch)) {
+	    flush();
 	  }
+	  return 0;
 	}
-
-	while(getline(corpusreader,word)) {
-	  if(word == eodmarker) goto EOD;
-	  int nextind=lookup_word(vocabmap, word, preindexed, oovi, digit_rep);
-
-	  context.push_back(nextind);
-
-	  int wid=context[contextsize];
-	  int meaning=0;
-
-	  if(format == SphericalKMeans) {
-	    meaning = kmeans->convertWord(context,  idfs, origvects, contextsize);
-	  } else if(format == HaliteAlgo) {
-#ifdef ENABLE_HALITE
-	    meaning = halite->convertWord(context, idfs, origvects, contextsize);
-#endif
-	  }
-				
-	  corpuswriter <<  std::setfill ('0') << std::setw (3) << meaning << vocab[wid]<<'\n';
-	  context.pop_front();
+      }
+      if(batch) {
+	if(cached) {
+	  pendingwindows.insert(pendingwindows.end(), window.begin(), window.end());
+	  pendingkeys.push_back(key);
 	}
-      EOD:
-	unsigned int k=0;
-	while(context.size()<2*contextsize+1) {
-	  context.push_back(enddoci);
-	  k++;
+	if(kmeans->addWord(context, contextsize, *batch)) {
+	  flush();
 	}
-	for(; k<contextsize; k++) {
-	  int wid=context[contextsize];
-	  int meaning=0;
+	return 0;
+      }
 
-	  if(format == SphericalKMeans) {
-	    meaning = kmeans->convertWord(context,  idfs, origvects, contextsize);
-	  } else if(format == HaliteAlgo) {
+      if(format == SphericalKMeans) {
+	meaning = kmeans->convertWord(context, contextsize, *scratch);
+	if(cached) {
+	  cache->insert(window.data(), key, meaning);
+	}
+      } else if(format == HaliteAlgo) {
 #ifdef ENABLE_HALITE
-	    meaning = halite->convertWord(context, idfs, origvects, contextsize);
+	meaning = halite->convertWord(context, contextsize);
 #endif
-	  }
+      }
+
+      append_token(out, wid, meaning);
+      return 0;
+    };
 
-	  corpuswriter <<  std::setfill ('0') << std::setw (3) << meaning << vocab[wid]<<'\n';
-	  context.pop_front();
-	  context.push_back(enddoci);
+    try {
+      int retcode;
+      if(chunk.indexed) {
+	IndexedCorpusFile corpus(chunk.path, vocab.size(), vocab.hash());
+	IndexedTokenSource source(corpus, chunk.begin, chunk.end);
+	retcode=walk_contexts(source, context, contextsize, startdoci, enddoci, emit);
+      } else {
+	std::ifstream corpusreader(chunk.path.c_str());
+	if(!corpusreader.good()) {
+	  return 7;
 	}
-      } while(!corpusreader.eof());
+	TextTokenSource source(corpusreader, chunk.begin, chunk.end, vocab, eodmarker, preindexed, oovi, digit_rep);
+	retcode=walk_contexts(source, context, contextsize, startdoci, enddoci, emit);
+      }
+      if(batch && batch->size) {
+	flush();
+      }
+      return retcode;
+    } catch(std::invalid_argument& e) {
+      std::cerr<<"Error, non-numerical line found in indexed corpus.\n  Please make sure your corpus is in the right format.\n";
+      return 9;
+    } catch(std::out_of_range& e) {
+      std::cerr << "Error, found out of bound index in indexed file.\n";
+      return 10;
+    } catch(std::runtime_error& e) {
+      std::cerr << "Error: " << e.what() << "\n";
+      return 11;
     }
-  } catch(std::invalid_argument& e) {
-    std::cerr<<"Error, non-numerical line found in indexed corpus.\n  Please make sure your corpus is in the right format.\n";
-    return 9;
-  } catch(std::out_of_range& e) {
-    std::cerr << "Error, found out of bound index in indexed file.\n";
-    return 10;
-  }  
-  return 0;
+  };
+
+  /*
+   * Workers relabel the chunks into memory, at most 2*numthreads chunks
+   * ahead of the writer, which writes them out in order.  The output is
+   * the same for any number of threads.
+   */
+  std::vector<std::string> outputs(chunks.size());
+  std::vector<bool> ready(chunks.size(), false);
+  size_t written=0;
+  int result=0;
+  std::mutex lock;
+  std::condition_variable changed;
+  std::atomic<size_t> nextchunk(0);
+  size_t maxpending=2*numthreads;
+
+  uint64_t lookups=0, hits=0;
+  auto worker=[&]() {
+    std::unique_ptr<WindowCache> cache;
+    if(cachesize) {
+      cache.reset(new WindowCache(cachesize, 2*contextsize+1));
+    }
+    size_t c;
+    while((c=nextchunk++)<chunks.size()) {
+      {
+	std::unique_lock<std::mutex> guard(lock);
+	changed.wait(guard, [&]() { return result || c<written+maxpending; });
+	if(result) {
+	  break;
+	}
+	if(chunks[c].begin==0) {
+	  std::cout << "Reading corpus file " << chunks[c].path << std::endl;
+	}
+      }
+      std::string out;
+      int retcode=relabel_chunk(chunks[c], out, cache.get());
+      std::lock_guard<std::mutex> guard(lock);
+      if(retcode && !result) {
+	result=retcode;
+      }
+      outputs[c].swap(out);
+      ready[c]=true;
+      changed.notify_all();
+    }
+    if(cache) {
+      std::lock_guard<std::mutex> guard(lock);
+      lookups+=cache->lookups;
+      hits+=cache->hits;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for(unsigned int t=0; t<numthreads; t++) {
+    threads.emplace_back(worker);
+  }
+
+  fs::ofstream corpuswriter;
+  std::unique_lock<std::mutex> guard(lock);
+  for(; written<chunks.size() && !result; ) {
+    const CorpusChunk& chunk=chunks[written];
+    if(chunk.begin==0) {
+      corpuswriter.close();
+      corpuswriter.open(outpaths[written], std::ios::binary);
+      if(!corpuswriter.good()) {
+	result=8;
+	break;
+      }
+      if(binary) {
+	write_indexed_corpus_header(corpuswriter, kmeans->numcenters, kmeans->sensehash);
+      }
+    }
+    changed.wait(guard, [&]() { return result || ready[written]; });
+    if(result) {
+      break;
+    }
+    std::string text;
+    text.swap(outputs[written]);
+    guard.unlock();
+    corpuswriter.write(text.data(), text.size());
+    guard.lock();
+    written++;
+    changed.notify_all();
+  }
+  changed.notify_all();
+  guard.unlock();
+  for(std::thread& t: threads) {
+    t.join();
+  }
+  if(result==0 && cachesize) {
+    std::cout << "Window cache: " << hits << " hits in " << lookups << " lookups (" << (lookups?100.0*hits/lookups:0) << "%)" << std::endl;
+  }
+  return result;
 }
 
 int main(int argc, char** argv) {
@@ -318,12 +783,16 @@ int main(int argc, char** argv) {
   std::string expandedvocabf;
   std::string idff;
   std::string vecf;
+  std::string modelf;
   std::string centersf;
   std::string icorpusf;
   std::string ocorpusf;
 
   unsigned int vecdim;
   unsigned int contextsize;
+  unsigned int numthreads;
+  size_t batchsize;
+  size_t cachesize;
   std::string eod, ssmarker, esmarker;
   std::string oovtoken, digit_rep;
   po::options_description desc("CRelabelCorpus Options");
@@ -331,16 +800,21 @@ int main(int argc, char** argv) {
     ("help,h", "produce help message")
     ("kmeans,k", "use spherical k-means clustering (default)")
     ("halite,l", " use Halite clustering")
-    ("oldvocab,v", po::value<std::string>(&vocabf)->value_name("<filename>")->required(), "original vocab file")
+    ("oldvocab,v", po::value<std::string>(&vocabf)->value_name("<filename>"), "original vocab file")
     ("newvocab,e", po::value<std::string>(&expandedvocabf)->value_name("<filename>")->required(), "new vocabulary file")
-    ("idf,f", po::value<std::string>(&idff)->value_name("<filename>")->required(), "original idf file")
-    ("oldvec,w", po::value<std::string>(&vecf)->value_name("<filename>")->required(), "original word vectors")
+    ("idf,f", po::value<std::string>(&idff)->value_name("<filename>"), "original idf file")
+    ("oldvec,w", po::value<std::string>(&vecf)->value_name("<filename>"), "original word vectors")
     ("centers,c", po::value<std::string>(&centersf)->value_name("<filename>")->required(), "cluster centers file")
     ("icorpus,i", po::value<std::string>(&icorpusf)->value_name("<directory>")->required(), "input corpus")
     ("ocorpus,o", po::value<std::string>(&ocorpusf)->value_name("<directory>")->required(), "output relabeled corpus")
     ("dim,d", po::value<unsigned int>(&vecdim)->value_name("<number>")->default_value(50), "dimension of word vectors")
     ("contextsize,s", po::value<unsigned int>(&contextsize)->value_name("<number>")->default_value(5),"size of context (# of words before and after)")
+    ("threads,t", po::value<unsigned int>(&numthreads)->value_name("<number>")->default_value(1), "number of worker threads (kmeans only)")
+    ("binary,b", "write the relabeled corpus as binary .idx files of expanded vocabulary ids (kmeans only)")
+    ("window-cache", po::value<size_t>(&cachesize)->value_name("<windows>")->default_value(0), "remember the senses of this many recent context windows per thread, to skip labeling repeated ones (kmeans only)")
+    ("batch", po::value<size_t>(&batchsize)->value_name("<tokens>")->default_value(0), "label this many tokens at a time, ranking the senses of each word for all its tokens at once (kmeans only, 0 to label each token alone)")
     ;
+  add_model_option(desc, &modelf);
 
   po::options_description markers("Special Token Options");
   add_eod_option(markers, &eod);
@@ -378,30 +852,36 @@ int main(int argc, char** argv) {
     return 1;
   }
 	
-  fs::ifstream oldvocab(vocabf);
-  if(!oldvocab.good()) {
-    std::cerr << "Original vocab file no good" <<std::endl;
+  if(numthreads==0) {
+    std::cerr << "Error: --threads must be at least 1\n";
     return 2;
   }
-	
+  //The Halite classifier is not safe to share between threads
+  if(numthreads>1 && format==HaliteAlgo) {
+    std::cerr << "Error: --threads needs kmeans clustering\n";
+    return 2;
+  }
+  if(batchsize && format==HaliteAlgo) {
+    std::cerr << "Error: --batch needs kmeans clustering\n";
+    return 2;
+  }
+  if(cachesize && format==HaliteAlgo) {
+    std::cerr << "Error: --window-cache needs kmeans clustering\n";
+    return 2;
+  }
+  if(vm.count("binary") && format==HaliteAlgo) {
+    std::cerr << "Error: --binary needs kmeans clustering\n";
+    return 2;
+  }
+
   fs::ifstream newvocab(expandedvocabf);
   if(!newvocab.good()) {
     std::cerr << "New vocab file no good" <<std::endl;
     return 3;
   }
 		
-  fs::ifstream idf(idff);
-  if(!newvocab.good()) {
-    std::cerr << "Original idf file no good" <<std::endl;
-    return 4;
-  }
-  fs::ifstream vectors(vecf);
-  if(!vectors.good()) {
-    std::cerr << "Original vectors file no good" <<std::endl;
-    return 5;
-  }
-  fs::ifstream centers(centersf);
-  if(!vectors.good()) {
+  fs::ifstream centers(centersf, std::ios::binary);
+  if(!centers.good()) {
     std::cerr << "Cluster centers file no good" <<std::endl;
     return 6;
   }
@@ -418,7 +898,7 @@ int main(int argc, char** argv) {
 
   bool preindexed=vm.count("preindexed")>0;
   if(preindexed) {
-    if(vm.count("oovtoken")){
+    if(vm.count("oovtoken") && !vm["oovtoken"].defaulted()){
       std::cerr <<"Error: --oovtoken is not applicable in preindexed mode\n";
       return 7;
     }
@@ -433,5 +913,11 @@ int main(int argc, char** argv) {
     digit_rep_arg=digit_rep;
   }
 
-  return relabel_corpus(format, oldvocab,newvocab,idf,vectors,centers,icorpus,ocorpus,vecdim,contextsize, eod, ssmarker, esmarker, preindexed, oovtoken, digit_rep_arg);
+  WordModel model;
+  int retcode=load_word_model(model, modelf, vocabf, idff, vecf, vecdim, !vm["dim"].defaulted());
+  if(retcode) {
+    return retcode;
+  }
+
+  return relabel_corpus(format, model, newvocab, centers, icorpus, ocorpus, contextsize, eod, ssmarker, esmarker, preindexed, oovtoken, digit_rep_arg, numthreads, batchsize, vm.count("binary")>0, cachesize);
 }
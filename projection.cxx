@@ -0,0 +1,99 @@
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Jeremy Salwen nor the name of any other
+//    contributor may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "projection.hpp"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "sphericalkmeans.hpp"
+
+void random_projection(unsigned int dim, unsigned int projdim, uint64_t seed, arma::fmat& basis) {
+  std::mt19937_64 rng(seed);
+  std::normal_distribution<double> gaussian;
+  //Gram-Schmidt on Gaussian vectors, in double, and drawing again in the unlikely case one is dependent
+  std::vector<double> columns(dim*projdim);
+  for(unsigned int j=0; j<projdim; j++) {
+    double* v=&columns[j*dim];
+    double sqnorm=0;
+    while(sqnorm<1e-6) {
+      for(unsigned int i=0; i<dim; i++) {
+	v[i]=gaussian(rng);
+      }
+      for(int pass=0; pass<2; pass++) {
+	for(unsigned int k=0; k<j; k++) {
+	  const double* u=&columns[k*dim];
+	  double d=0;
+	  for(unsigned int i=0; i<dim; i++) {
+	    d+=u[i]*v[i];
+	  }
+	  for(unsigned int i=0; i<dim; i++) {
+	    v[i]-=d*u[i];
+	  }
+	}
+      }
+      sqnorm=0;
+      for(unsigned int i=0; i<dim; i++) {
+	sqnorm+=v[i]*v[i];
+      }
+    }
+    double scale=1/std::sqrt(sqnorm);
+    for(unsigned int i=0; i<dim; i++) {
+      v[i]*=scale;
+    }
+  }
+  basis.set_size(dim, projdim);
+  std::copy(columns.begin(), columns.end(), basis.memptr());
+}
+
+double pca_projection(const arma::fmat& sample, unsigned int projdim, arma::fmat& basis) {
+  unsigned int dim=sample.n_rows;
+  std::vector<float> invnorms;
+  inverse_norms(sample, invnorms);
+  arma::fmat unit(dim, sample.n_cols);
+  for(size_t p=0; p<sample.n_cols; p++) {
+    for(unsigned int i=0; i<dim; i++) {
+      unit(i,p)=sample(i,p)*invnorms[p];
+    }
+  }
+  arma::fmat moments=unit*unit.t();
+  arma::fvec values;
+  arma::fmat vectors;
+  if(!arma::eig_sym(values, vectors, moments)) {
+    return -1;
+  }
+  //The eigenvalues are in increasing order
+  basis.set_size(dim, projdim);
+  double kept=0, total=0;
+  for(unsigned int i=0; i<dim; i++) {
+    total+=values[i];
+  }
+  for(unsigned int j=0; j<projdim; j++) {
+    unsigned int k=dim-1-j;
+    kept+=values[k];
+    std::copy(vectors.colptr(k), vectors.colptr(k)+dim, basis.colptr(j));
+  }
+  return total>0?kept/total:0;
+}
@@ -0,0 +1,54 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Jeremy Salwen nor the name of any other
+ *    contributor may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include <cstdint>
+
+#include <armadillo>
+
+/*
+ * A projection is a dim x projdim matrix with orthonormal columns.  A
+ * context x is clustered as basis.t()*x, and a center c found there is
+ * mapped back to basis*c.  Since the columns are orthonormal, the mapped
+ * back center has the norm of c and its dot product with any context is
+ * that of c with the projected context, so the center a context is
+ * closest to is the same in both spaces.
+ */
+
+//Sets basis to an orthonormal basis of a random projdim dimensional subspace, drawn from seed
+void random_projection(unsigned int dim, unsigned int projdim, uint64_t seed, arma::fmat& basis);
+
+/*
+ * Sets basis to the projdim directions that keep the most of the squared
+ * norm of the columns of sample, once each is scaled to unit norm.  The
+ * sample is not centered, since clusters are directions from the origin.
+ * Returns the fraction of the squared norm that is kept, or a negative
+ * number if the eigendecomposition fails.
+ */
+double pca_projection(const arma::fmat& sample, unsigned int projdim, arma::fmat& basis);
+
+#endif
@@ -0,0 +1,580 @@
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Jeremy Salwen nor the name of any other
+//    contributor may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "sphericalkmeans.hpp"
+
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <cstring>
+
+#include "contextkernels.hpp"
+#include "common.hpp"
+
+void inverse_norms(const arma::fmat& data, std::vector<float>& invnorms) {
+  invnorms.resize(data.n_cols);
+  for(size_t p=0; p<data.n_cols; p++) {
+    const float* x=data.colptr(p);
+    float sqnorm=0;
+    for(size_t d=0; d<data.n_rows; d++) {
+      sqnorm+=x[d]*x[d];
+    }
+    invnorms[p]=sqnorm>0?1/std::sqrt(sqnorm):0;
+  }
+}
+
+//The total weight of n points, which is n if they have no weights
+static double total_weight(const float* weights, size_t n) {
+  return weights?std::accumulate(weights, weights+n, 0.0):n;
+}
+
+//Sets chosen to k distinct numbers below n in increasing order, with Floyd's algorithm for a sample without replacement
+static void sample_distinct(size_t n, size_t k, std::mt19937_64& rng, std::vector<size_t>& chosen) {
+  chosen.clear();
+  for(size_t j=n-k; j<n; j++) {
+    size_t t=std::uniform_int_distribution<size_t>(0, j)(rng);
+    if(std::find(chosen.begin(), chosen.end(), t)!=chosen.end()) {
+      t=j;
+    }
+    chosen.push_back(t);
+  }
+  std::sort(chosen.begin(), chosen.end());
+}
+
+void random_centroids(const arma::fmat& data, std::mt19937_64& rng, arma::fmat& centroids, size_t given) {
+  size_t numnew=centroids.n_cols-given;
+  std::vector<size_t> chosen;
+  sample_distinct(data.n_cols, numnew, rng, chosen);
+  for(size_t i=0; i<numnew; i++) {
+    std::copy(data.colptr(chosen[i]), data.colptr(chosen[i])+data.n_rows, centroids.colptr(given+i));
+  }
+}
+
+void kmeanspp_centroids(const arma::fmat& data, std::mt19937_64& rng, arma::fmat& centroids, size_t given, const float* weights) {
+  std::vector<float> invnorms;
+  inverse_norms(data, invnorms);
+  size_t n=data.n_cols;
+  size_t dim=data.n_rows;
+
+  //Distance of each point to the nearest centroid chosen so far
+  std::vector<double> distances(n, 1.0);
+  size_t p;
+  if(weights) {
+    double r=std::uniform_real_distribution<double>(0, total_weight(weights, n))(rng);
+    for(p=0; p<n-1 && (r-=weights[p])>=0; p++);
+  } else {
+    p=std::uniform_int_distribution<size_t>(0, n-1)(rng);
+  }
+  for(size_t j=0; j<centroids.n_cols; j++) {
+    float* c=centroids.colptr(j);
+    //The given centroids need not have unit norm
+    float cinverse=1;
+    if(j<given) {
+      float sqnorm=0;
+      for(size_t d=0; d<dim; d++) {
+	sqnorm+=c[d]*c[d];
+      }
+      cinverse=sqnorm>0?1/std::sqrt(sqnorm):0;
+    } else {
+      if(j>0) {
+	double total=0;
+	for(size_t q=0; q<n; q++) {
+	  total+=distances[q]*(weights?weights[q]:1);
+	}
+	if(total>0) {
+	  double r=std::uniform_real_distribution<double>(0, total)(rng);
+	  for(p=0; p<n-1 && (r-=distances[p]*(weights?weights[p]:1))>=0; p++);
+	} else {
+	  p=std::uniform_int_distribution<size_t>(0, n-1)(rng);
+	}
+      }
+      for(size_t d=0; d<dim; d++) {
+	c[d]=data(d,p)*invnorms[p];
+      }
+    }
+    for(size_t q=0; q<n; q++) {
+      const float* x=data.colptr(q);
+      float dot=0;
+      for(size_t d=0; d<dim; d++) {
+	dot+=x[d]*c[d];
+      }
+      double cos=dot*invnorms[q]*cinverse;
+      distances[q]=std::min(distances[q], 1-cos*cos);
+    }
+  }
+}
+
+//Sets out to x scaled to unit norm.  Returns false, leaving out alone, if x is zero
+static bool normalize(const float* x, float* out, size_t dim) {
+  float sqnorm=0;
+  for(size_t d=0; d<dim; d++) {
+    sqnorm+=x[d]*x[d];
+  }
+  if(sqnorm<=0) {
+    return false;
+  }
+  float inverse=1/std::sqrt(sqnorm);
+  for(size_t d=0; d<dim; d++) {
+    out[d]=x[d]*inverse;
+  }
+  return true;
+}
+
+/*
+ * Assigns every point to the centroid with the largest squared cosine,
+ * and records the sign of its cosine and its squared cosine.  Counts in
+ * changed the points whose assignment changed, or all of them if first.
+ * Returns the sum of the squared cosines, times the points' weights if
+ * there are any.
+ */
+static double assign_points(const arma::fmat& data, const std::vector<float>& invnorms, const float* weights, const arma::fmat& centroids, arma::Col<size_t>& assignments, std::vector<float>& signs, std::vector<float>& fits, bool first, size_t& changed) {
+  size_t n=data.n_cols;
+  size_t dim=data.n_rows;
+  size_t numclust=centroids.n_cols;
+  double objective=0;
+  changed=0;
+  for(size_t b=0; b<n; b+=KMEANS_BLOCK_POINTS) {
+    size_t m=std::min(KMEANS_BLOCK_POINTS, n-b);
+    const arma::fmat block(const_cast<float*>(data.colptr(b)), dim, m, false, true);
+    arma::fmat dots=centroids.t()*block;
+    for(size_t p=0; p<m; p++) {
+      const float* s=dots.colptr(p);
+      size_t best=0;
+      for(size_t j=1; j<numclust; j++) {
+	if(s[j]*s[j] > s[best]*s[best]) {
+	  best=j;
+	}
+      }
+      if(first || assignments[b+p]!=best) {
+	changed++;
+      }
+      assignments[b+p]=best;
+      signs[b+p]=s[best]<0?-1:1;
+      float cos=s[best]*invnorms[b+p];
+      fits[b+p]=cos*cos;
+      objective+=(weights?weights[b+p]:1)*cos*cos;
+    }
+  }
+  return objective;
+}
+
+/*
+ * Sets each column of sums to the weighted sum of the unit points of a
+ * cluster, with their signs aligned, and counts to their total weight.
+ */
+static void sum_clusters(const arma::fmat& data, const std::vector<float>& invnorms, const float* weights, const std::vector<float>& signs, const arma::Col<size_t>& assignments, arma::fmat& sums, std::vector<double>& counts) {
+  ContextKernels kernels=context_kernels(data.n_rows);
+  sums.zeros();
+  std::fill(counts.begin(), counts.end(), 0);
+  for(size_t p=0; p<data.n_cols; p++) {
+    if(invnorms[p]>0) {
+      float weight=weights?weights[p]:1;
+      kernels.axpy(weight*signs[p]*invnorms[p], data.colptr(p), sums.colptr(assignments[p]), data.n_rows);
+      counts[assignments[p]]+=weight;
+    }
+  }
+}
+
+//Moves each centroid to the normalized sum of its points
+static void update_centroids(const arma::fmat& data, const std::vector<float>& invnorms, const float* weights, const std::vector<float>& signs, const arma::Col<size_t>& assignments, std::vector<float>& fits, arma::fmat& sums, std::vector<double>& counts, arma::fmat& centroids) {
+  size_t dim=data.n_rows;
+  sum_clusters(data, invnorms, weights, signs, assignments, sums, counts);
+  for(size_t j=0; j<centroids.n_cols; j++) {
+    if(counts[j]>0 && normalize(sums.colptr(j), centroids.colptr(j), dim)) {
+      continue;
+    }
+    //An empty cluster takes the point that fits its centroid worst
+    size_t worst=std::min_element(fits.begin(), fits.end())-fits.begin();
+    for(size_t d=0; d<dim; d++) {
+      centroids(d,j)=data(d,worst)*invnorms[worst];
+    }
+    fits[worst]=1;
+  }
+}
+
+//The angle between the lines through two vectors with the given cosine
+static double line_angle(double cos) {
+  return std::acos(std::min(1.0, std::fabs(cos)));
+}
+
+static double dot(const float* x, const float* y, size_t dim) {
+  double sum=0;
+  for(size_t d=0; d<dim; d++) {
+    sum+=x[d]*y[d];
+  }
+  return sum;
+}
+
+//sample_points, also copying the weights or counts of the sampled points to sampleweights if there are any
+template<typename Weight>
+static void sample_chunks(const PointSource& data, const Weight* weights, size_t numpoints, std::mt19937_64& rng, arma::fmat& sample, std::vector<float>& sampleweights) {
+  size_t dim=data.dim();
+  size_t n=data.numPoints();
+  size_t chunk=std::min<size_t>(MINIBATCH_CHUNK_POINTS, n);
+  /*
+   * The chunks must not overlap, or a point could be sampled twice.  Each
+   * chunk stands for one slot among the points left out, and shifting the
+   * chosen slots by the chunks before them gives every placement of the
+   * chunks the same chance.  The chunks are in file order, so they are
+   * read front to back.
+   */
+  std::vector<size_t> starts;
+  size_t numchunks=(numpoints+chunk-1)/chunk;
+  sample_distinct(n-numpoints+numchunks, numchunks, rng, starts);
+  for(size_t i=0; i<numchunks; i++) {
+    starts[i]+=i*(chunk-1);
+  }
+  sample.set_size(dim, numpoints);
+  for(size_t i=0; i<starts.size(); i++) {
+    size_t m=std::min(chunk, numpoints-i*chunk);
+    data.read(starts[i], m, sample.colptr(i*chunk));
+  }
+  if(weights) {
+    sampleweights.resize(numpoints);
+    for(size_t i=0; i<starts.size(); i++) {
+      size_t m=std::min(chunk, numpoints-i*chunk);
+      std::copy(weights+starts[i], weights+starts[i]+m, sampleweights.begin()+i*chunk);
+    }
+  }
+}
+
+void sample_points(const arma::fmat& data, size_t numpoints, std::mt19937_64& rng, arma::fmat& sample) {
+  sample_points(MatrixPointSource(data), numpoints, rng, sample);
+}
+
+void sample_points(const PointSource& source, size_t numpoints, std::mt19937_64& rng, arma::fmat& sample) {
+  std::vector<float> unused;
+  sample_chunks<float>(source, nullptr, numpoints, rng, sample, unused);
+}
+
+void sample_points(const arma::fmat& data, const std::vector<uint64_t>& counts, size_t numpoints, std::mt19937_64& rng, arma::fmat& sample, std::vector<float>& sampleweights) {
+  sample_chunks(MatrixPointSource(data), counts.data(), numpoints, rng, sample, sampleweights);
+}
+
+SphericalKMeansClusterer::SphericalKMeansClusterer(size_t maxiterations, double tolerance): maxiterations(maxiterations), tolerance(tolerance), batchsize(0), numbatches(0), finalpass(false), bounded(false) {
+}
+
+double SphericalKMeansClusterer::cluster(const arma::fmat& data, arma::fmat& centroids, arma::Col<size_t>& assignments, std::mt19937_64& rng) const {
+  std::vector<float> invnorms;
+  if(!minibatch(data.n_cols) || finalpass) {
+    inverse_norms(data, invnorms);
+  }
+  return cluster(data, invnorms, centroids, assignments, rng);
+}
+
+bool SphericalKMeansClusterer::minibatch(size_t numpoints) const {
+  return batchsize && numpoints > batchsize;
+}
+
+double SphericalKMeansClusterer::cluster(const arma::fmat& data, const std::vector<float>& invnorms, arma::fmat& centroids, arma::Col<size_t>& assignments, std::mt19937_64& rng) const {
+  return cluster(data, invnorms, std::vector<float>(), centroids, assignments, rng);
+}
+
+double SphericalKMeansClusterer::cluster(const arma::fmat& data, const std::vector<float>& invnorms, const std::vector<float>& weights, arma::fmat& centroids, arma::Col<size_t>& assignments, std::mt19937_64& rng) const {
+  const float* w=weights.empty()?nullptr:weights.data();
+  //The centroids are kept at unit norm, so a dot product times the point's inverse norm is the cosine
+  for(size_t j=0; j<centroids.n_cols; j++) {
+    normalize(centroids.colptr(j), centroids.colptr(j), centroids.n_rows);
+  }
+  if(minibatch(data.n_cols)) {
+    return clusterMiniBatch(data, invnorms, w, centroids, assignments, rng);
+  }
+  if(bounded && centroids.n_cols > 1) {
+    return clusterBounded(data, invnorms, w, centroids, assignments);
+  }
+  return clusterFull(data, invnorms, w, centroids, assignments);
+}
+
+double SphericalKMeansClusterer::cluster(const PointSource& source, arma::fmat& centroids, std::mt19937_64& rng) const {
+  for(size_t j=0; j<centroids.n_cols; j++) {
+    normalize(centroids.colptr(j), centroids.colptr(j), centroids.n_rows);
+  }
+  return miniBatches(source, nullptr, centroids, rng);
+}
+
+double SphericalKMeansClusterer::clusterFull(const arma::fmat& data, const std::vector<float>& invnorms, const float* weights, arma::fmat& centroids, arma::Col<size_t>& assignments) const {
+  size_t n=data.n_cols;
+  size_t dim=data.n_rows;
+  size_t numclust=centroids.n_cols;
+
+  std::vector<float> signs(n);
+  std::vector<float> fits(n);
+  std::vector<double> counts(numclust);
+  arma::fmat sums(dim, numclust);
+
+  assignments.set_size(n);
+  double totalweight=total_weight(weights, n);
+  double objective=0, previous=0;
+  for(size_t iteration=0; ; iteration++) {
+    size_t changed;
+    objective=assign_points(data, invnorms, weights, centroids, assignments, signs, fits, iteration==0, changed)/totalweight;
+
+    if(changed==0 || iteration>=maxiterations || (iteration>0 && objective-previous <= tolerance*objective)) {
+      break;
+    }
+    previous=objective;
+
+    update_centroids(data, invnorms, weights, signs, assignments, fits, sums, counts, centroids);
+  }
+  return objective;
+}
+
+double SphericalKMeansClusterer::clusterBounded(const arma::fmat& data, const std::vector<float>& invnorms, const float* weights, arma::fmat& centroids, arma::Col<size_t>& assignments) const {
+  size_t n=data.n_cols;
+  size_t dim=data.n_rows;
+  size_t numclust=centroids.n_cols;
+
+  std::vector<float> signs(n);
+  std::vector<float> fits(n);
+  std::vector<double> counts(numclust);
+  arma::fmat sums(dim, numclust);
+
+  //Angle from each point to its centroid, and a lower bound on its angle to every other centroid
+  std::vector<double> upper(n);
+  std::vector<double> lower(n);
+  //Half the angle from each centroid to the nearest other one, and how far each centroid moved
+  std::vector<double> halfgap(numclust);
+  std::vector<double> drift(numclust);
+  arma::fmat previous_centroids;
+
+  //Points which need to be compared with every centroid, copied into a block for one GEMM
+  std::vector<size_t> pending;
+  pending.reserve(KMEANS_BLOCK_POINTS);
+  arma::fmat block(dim, KMEANS_BLOCK_POINTS);
+
+  assignments.set_size(n);
+  double totalweight=total_weight(weights, n);
+  double objective=0, previous=0;
+  for(size_t iteration=0; ; iteration++) {
+    size_t changed=0;
+    objective=0;
+
+    auto assign_pending=[&]() {
+      for(size_t i=0; i<pending.size(); i++) {
+	std::copy(data.colptr(pending[i]), data.colptr(pending[i])+dim, block.colptr(i));
+      }
+      const arma::fmat used(block.memptr(), dim, pending.size(), false, true);
+      arma::fmat dots=centroids.t()*used;
+      for(size_t i=0; i<pending.size(); i++) {
+	size_t p=pending[i];
+	const float* s=dots.colptr(i);
+	size_t best=0;
+	for(size_t j=1; j<numclust; j++) {
+	  if(s[j]*s[j] > s[best]*s[best]) {
+	    best=j;
+	  }
+	}
+	float second=0;
+	for(size_t j=0; j<numclust; j++) {
+	  if(j!=best) {
+	    second=std::max(second, s[j]*s[j]);
+	  }
+	}
+	if(iteration==0 || assignments[p]!=best) {
+	  changed++;
+	}
+	assignments[p]=best;
+	signs[p]=s[best]<0?-1:1;
+	float cos=s[best]*invnorms[p];
+	fits[p]=cos*cos;
+	objective+=(weights?weights[p]:1)*cos*cos;
+	upper[p]=line_angle(cos);
+	lower[p]=line_angle(std::sqrt(second)*invnorms[p]);
+      }
+      pending.clear();
+    };
+
+    if(iteration>0) {
+      arma::fmat gram=centroids.t()*centroids;
+      for(size_t j=0; j<numclust; j++) {
+	double closest=M_PI/2;
+	for(size_t k=0; k<numclust; k++) {
+	  if(k!=j) {
+	    closest=std::min(closest, line_angle(gram(k,j)));
+	  }
+	}
+	halfgap[j]=closest/2;
+      }
+      //The lower bounds only need to allow for the other centroids moving
+      size_t farthest=std::max_element(drift.begin(), drift.end())-drift.begin();
+      double seconddrift=0;
+      for(size_t j=0; j<numclust; j++) {
+	if(j!=farthest) {
+	  seconddrift=std::max(seconddrift, drift[j]);
+	}
+      }
+      for(size_t p=0; p<n; p++) {
+	size_t a=assignments[p];
+	lower[p]-=(a==farthest?seconddrift:drift[farthest]);
+	double cos=dot(data.colptr(p), centroids.colptr(a), dim)*invnorms[p];
+	upper[p]=line_angle(cos);
+	if(upper[p]+KMEANS_BOUND_SLACK < std::max(halfgap[a], lower[p])) {
+	  signs[p]=cos<0?-1:1;
+	  fits[p]=cos*cos;
+	  objective+=(weights?weights[p]:1)*cos*cos;
+	  continue;
+	}
+	pending.push_back(p);
+	if(pending.size()==KMEANS_BLOCK_POINTS) {
+	  assign_pending();
+	}
+      }
+    } else {
+      for(size_t p=0; p<n; p++) {
+	pending.push_back(p);
+	if(pending.size()==KMEANS_BLOCK_POINTS) {
+	  assign_pending();
+	}
+      }
+    }
+    assign_pending();
+    objective/=totalweight;
+
+    if(changed==0 || iteration>=maxiterations || (iteration>0 && objective-previous <= tolerance*objective)) {
+      break;
+    }
+    previous=objective;
+
+    previous_centroids=centroids;
+    update_centroids(data, invnorms, weights, signs, assignments, fits, sums, counts, centroids);
+    for(size_t j=0; j<numclust; j++) {
+      drift[j]=line_angle(dot(previous_centroids.colptr(j), centroids.colptr(j), dim));
+    }
+  }
+  return objective;
+}
+
+double SphericalKMeansClusterer::clusterMiniBatch(const arma::fmat& data, const std::vector<float>& invnorms, const float* weights, arma::fmat& centroids, arma::Col<size_t>& assignments, std::mt19937_64& rng) const {
+  double objective=miniBatches(MatrixPointSource(data), weights, centroids, rng);
+  if(!finalpass) {
+    assignments.reset();
+    return objective;
+  }
+  assignments.set_size(data.n_cols);
+  std::vector<float> signs(data.n_cols);
+  std::vector<float> fits(data.n_cols);
+  size_t changed;
+  return assign_points(data, invnorms, weights, centroids, assignments, signs, fits, true, changed)/total_weight(weights, data.n_cols);
+}
+
+double SphericalKMeansClusterer::miniBatches(const PointSource& data, const float* weights, arma::fmat& centroids, std::mt19937_64& rng) const {
+  size_t dim=data.dim();
+  size_t numclust=centroids.n_cols;
+
+  arma::fmat batch;
+  std::vector<float> batchinvnorms;
+  std::vector<float> signs(batchsize);
+  std::vector<float> fits(batchsize);
+  arma::Col<size_t> batchassignments(batchsize);
+  std::vector<double> counts(numclust);
+  arma::fmat sums(dim, numclust);
+  std::vector<float> batchweights;
+  //Total weight of the points each centroid is the mean of so far
+  std::vector<double> masses(numclust, 0);
+  std::vector<float> updated(dim);
+
+  double objective=0;
+  for(size_t b=0; b<numbatches; b++) {
+    sample_chunks(data, weights, batchsize, rng, batch, batchweights);
+    const float* bw=weights?batchweights.data():nullptr;
+    inverse_norms(batch, batchinvnorms);
+    size_t changed;
+    objective=assign_points(batch, batchinvnorms, bw, centroids, batchassignments, signs, fits, true, changed)/total_weight(bw, batchsize);
+    sum_clusters(batch, batchinvnorms, bw, signs, batchassignments, sums, counts);
+
+    //Each centroid moves to the mean of all the points it was assigned so
+    //far, so its learning rate falls as 1/(number of points)
+    double movement=0;
+    for(size_t j=0; j<numclust; j++) {
+      if(counts[j]==0) {
+	continue;
+      }
+      float* c=centroids.colptr(j);
+      for(size_t d=0; d<dim; d++) {
+	updated[d]=c[d]*masses[j]+sums(d,j);
+      }
+      masses[j]+=counts[j];
+      if(!normalize(updated.data(), updated.data(), dim)) {
+	continue;
+      }
+      double cos=0;
+      for(size_t d=0; d<dim; d++) {
+	cos+=updated[d]*c[d];
+      }
+      movement=std::max(movement, 1-cos*cos);
+      std::copy(updated.begin(), updated.end(), c);
+    }
+    if(movement < tolerance) {
+      break;
+    }
+  }
+  return objective;
+}
+
+double mean_squared_cosine(const arma::fmat& data, const arma::fmat& centroids) {
+  std::vector<float> invnorms;
+  inverse_norms(data, invnorms);
+  arma::fmat unit(centroids.n_rows, centroids.n_cols);
+  for(size_t j=0; j<centroids.n_cols; j++) {
+    if(!normalize(centroids.colptr(j), unit.colptr(j), centroids.n_rows)) {
+      std::fill(unit.colptr(j), unit.colptr(j)+centroids.n_rows, 0);
+    }
+  }
+  arma::Col<size_t> assignments(data.n_cols);
+  std::vector<float> signs(data.n_cols);
+  std::vector<float> fits(data.n_cols);
+  size_t changed;
+  return assign_points(data, invnorms, nullptr, unit, assignments, signs, fits, true, changed)/data.n_cols;
+}
+
+size_t deduplicate_points(const arma::fmat& data, arma::fmat& distinct, std::vector<uint64_t>& counts) {
+  size_t dim=data.n_rows;
+  size_t bytes=dim*sizeof(float);
+  //Hash of each distinct point, to the index of the point in firsts
+  std::unordered_multimap<uint64_t, size_t> seen(data.n_cols);
+  std::vector<size_t> firsts;
+  counts.clear();
+  for(size_t p=0; p<data.n_cols; p++) {
+    const char* x=(const char*)data.colptr(p);
+    uint64_t unused;
+    uint64_t hash=content_checksum(x, bytes, 0, unused);
+    auto range=seen.equal_range(hash);
+    auto match=std::find_if(range.first, range.second, [&](const std::pair<const uint64_t, size_t>& e) {
+	return std::memcmp(data.colptr(firsts[e.second]), x, bytes)==0;
+      });
+    if(match!=range.second) {
+      counts[match->second]++;
+      continue;
+    }
+    seen.emplace(hash, firsts.size());
+    firsts.push_back(p);
+    counts.push_back(1);
+  }
+  distinct.set_size(dim, firsts.size());
+  for(size_t i=0; i<firsts.size(); i++) {
+    std::copy(data.colptr(firsts[i]), data.colptr(firsts[i])+dim, distinct.colptr(i));
+  }
+  return firsts.size();
+}
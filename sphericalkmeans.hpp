@@ -0,0 +1,203 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Jeremy Salwen nor the name of any other
+ *    contributor may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef SPHERICAL_KMEANS_H
+#define SPHERICAL_KMEANS_H
+
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <algorithm>
+
+#include <armadillo>
+
+/*
+ * Spherical k-means on lines through the origin: a point belongs to the
+ * centroid with the largest squared cosine, the same similarity that
+ * CosineSqrKernel gives when relabeling.  The points are only scaled by
+ * their inverse norms, which are computed once, so they can be used in
+ * place from a memory mapped file.  The assignment step multiplies the
+ * centroids with blocks of points in a single GEMM, and each centroid is
+ * the normalized mean of its points, with each point's sign flipped to
+ * agree with the centroid.
+ *
+ * If batchsize is set, words with more points than that are clustered
+ * with mini-batch k-means instead, which looks at no more than numbatches
+ * random batches of points, so the cost does not grow with the number of
+ * points.  Each batch is made of runs of consecutive points, taken in
+ * order, so it is read mostly sequentially.  Each centroid is the running
+ * mean of the points assigned to it in all the batches.
+ *
+ * If bounded is set, the full batch iterations use Hamerly's bounds to
+ * skip most of the assignment work once the clusters settle.  The angle
+ * between two lines, arccos |cos|, is a metric, so a point whose angle
+ * to its centroid is less than half the angle from that centroid to any
+ * other, or less than a lower bound on its angle to all the others,
+ * cannot change cluster.  Those points only need the cosine with their
+ * own centroid; the rest are multiplied with all the centroids.  The
+ * clusters are the same as without the bounds, except for rounding in
+ * near ties.
+ */
+
+//Number of points multiplied with the centroids at a time
+const size_t KMEANS_BLOCK_POINTS=4096;
+
+//Margin, in radians, by which a bound must rule out a change of cluster
+const double KMEANS_BOUND_SLACK=1e-5;
+
+//Mini-batches are made of runs of this many consecutive points
+const size_t MINIBATCH_CHUNK_POINTS=256;
+
+/*
+ * Points that mini-batches are sampled from, read a run at a time, so
+ * that they need not all be in memory as floats at once.
+ */
+class PointSource {
+public:
+  virtual ~PointSource() {}
+
+  virtual size_t numPoints() const=0;
+  virtual unsigned int dim() const=0;
+
+  //Writes the n points from first on to out, one after another
+  virtual void read(size_t first, size_t n, float* out) const=0;
+};
+
+//The columns of a matrix as a PointSource
+class MatrixPointSource: public PointSource {
+public:
+  MatrixPointSource(const arma::fmat& data): data(data) {
+  }
+
+  size_t numPoints() const {
+    return data.n_cols;
+  }
+
+  unsigned int dim() const {
+    return data.n_rows;
+  }
+
+  void read(size_t first, size_t n, float* out) const {
+    std::copy(data.colptr(first), data.colptr(first)+n*data.n_rows, out);
+  }
+
+private:
+  const arma::fmat& data;
+};
+
+class SphericalKMeansClusterer {
+public:
+  SphericalKMeansClusterer(size_t maxiterations, double tolerance);
+
+  /*
+   * Clusters the columns of data into centroids.n_cols clusters, starting
+   * from the given centroids.  Stops when no point changes cluster, when
+   * the objective improves by less than the tolerance (relative), or after
+   * maxiterations.  Returns the objective, the mean over the points of
+   * their squared cosine with their centroid.  The centroids are returned
+   * with unit norm.
+   *
+   * Mini-batch clustering stops once no centroid moves by more than the
+   * tolerance (1 minus the squared cosine of the old and new centroid),
+   * and then only assigns all the points if finalpass is set.  Otherwise
+   * assignments is left empty, and the objective is that of the last
+   * batch.  The batches are drawn from rng.
+   */
+  double cluster(const arma::fmat& data, arma::fmat& centroids, arma::Col<size_t>& assignments, std::mt19937_64& rng) const;
+
+  /*
+   * The same, with the inverse norms of the points already computed by
+   * inverse_norms, so they can be shared between runs on the same points.
+   * Mini-batch clustering only uses them for the final pass.
+   */
+  double cluster(const arma::fmat& data, const std::vector<float>& invnorms, arma::fmat& centroids, arma::Col<size_t>& assignments, std::mt19937_64& rng) const;
+
+  /*
+   * The same, with each point counting weights[p] times, as if it were
+   * repeated.  The objective is then the weighted mean.
+   */
+  double cluster(const arma::fmat& data, const std::vector<float>& invnorms, const std::vector<float>& weights, arma::fmat& centroids, arma::Col<size_t>& assignments, std::mt19937_64& rng) const;
+
+  /*
+   * Mini-batch clustering of the points of source, reading only the runs
+   * that are sampled.  There is no final pass whatever finalpass is, and
+   * the objective is that of the last batch.
+   */
+  double cluster(const PointSource& source, arma::fmat& centroids, std::mt19937_64& rng) const;
+
+  //Whether numpoints points would be clustered with mini-batches
+  bool minibatch(size_t numpoints) const;
+
+  size_t maxiterations;
+  double tolerance;
+  size_t batchsize;
+  size_t numbatches;
+  bool finalpass;
+  bool bounded;
+
+private:
+  double clusterFull(const arma::fmat& data, const std::vector<float>& invnorms, const float* weights, arma::fmat& centroids, arma::Col<size_t>& assignments) const;
+  double clusterBounded(const arma::fmat& data, const std::vector<float>& invnorms, const float* weights, arma::fmat& centroids, arma::Col<size_t>& assignments) const;
+  double clusterMiniBatch(const arma::fmat& data, const std::vector<float>& invnorms, const float* weights, arma::fmat& centroids, arma::Col<size_t>& assignments, std::mt19937_64& rng) const;
+  //The mini-batch steps, returning the objective of the last batch
+  double miniBatches(const PointSource& source, const float* weights, arma::fmat& centroids, std::mt19937_64& rng) const;
+};
+
+//Sets invnorms to the inverse norms of the columns of data, or 0 for zero columns
+void inverse_norms(const arma::fmat& data, std::vector<float>& invnorms);
+
+//Sets sample to numpoints distinct points of data, at most data.n_cols, taken in non-overlapping runs of MINIBATCH_CHUNK_POINTS from random places
+void sample_points(const arma::fmat& data, size_t numpoints, std::mt19937_64& rng, arma::fmat& sample);
+//The same, reading only the sampled runs of source
+void sample_points(const PointSource& source, size_t numpoints, std::mt19937_64& rng, arma::fmat& sample);
+//The same, also setting sampleweights to the counts of the sampled points, as weights
+void sample_points(const arma::fmat& data, const std::vector<uint64_t>& counts, size_t numpoints, std::mt19937_64& rng, arma::fmat& sample, std::vector<float>& sampleweights);
+
+/*
+ * Sets the columns of centroids to distinct random points of data, except
+ * for the first given columns, which are kept.
+ */
+void random_centroids(const arma::fmat& data, std::mt19937_64& rng, arma::fmat& centroids, size_t given=0);
+
+/*
+ * Sets the columns of centroids to points of data chosen by k-means++,
+ * with 1 minus the squared cosine as the distance.  The first given
+ * columns are kept, and count as already chosen, so a solution with
+ * fewer clusters can be extended.  If there are weights, each point is
+ * chosen as if it were repeated weights[p] times.
+ */
+void kmeanspp_centroids(const arma::fmat& data, std::mt19937_64& rng, arma::fmat& centroids, size_t given=0, const float* weights=nullptr);
+
+/*
+ * Sets distinct to the distinct columns of data, in order of first
+ * appearance, and counts to how many times each appears.  Columns are
+ * compared bit for bit.  Returns the number of distinct columns.
+ */
+size_t deduplicate_points(const arma::fmat& data, arma::fmat& distinct, std::vector<uint64_t>& counts);
+
+//The mean over the points of data of their largest squared cosine with a column of centroids
+double mean_squared_cosine(const arma::fmat& data, const arma::fmat& centroids);
+
+#endif
@@ -0,0 +1,122 @@
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Jeremy Salwen nor the name of any other
+//    contributor may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#include "vocabulary.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "common.hpp"
+
+const size_t INITIAL_SLOTS=1024;
+
+Vocabulary::Vocabulary(): offsets(1, 0), slots(INITIAL_SLOTS, 0), tags(INITIAL_SLOTS, 0), mask(INITIAL_SLOTS-1), vocabhash(VOCAB_HASH_INIT) {
+}
+
+uint64_t Vocabulary::hash_word(boost::string_ref word) {
+  //Multiply-xorshift over 8 byte blocks
+  const uint64_t m=0x9E3779B97F4A7C15ULL;
+  uint64_t h=word.size()*m;
+  const char* p=word.data();
+  size_t n=word.size();
+  for(; n>=8; p+=8, n-=8) {
+    uint64_t block;
+    std::memcpy(&block, p, 8);
+    h=(h^block)*m;
+    h^=h>>29;
+  }
+  uint64_t last=0;
+  std::memcpy(&last, p, n);
+  h=(h^last)*m;
+  h^=h>>32;
+  return h*m;
+}
+
+size_t Vocabulary::find_slot(boost::string_ref word, uint64_t h) const {
+  uint32_t tag=h>>32;
+  size_t i=h&mask;
+  while(slots[i]) {
+    if(tags[i]==tag && this->word(slots[i]-1)==word) {
+      break;
+    }
+    i=(i+1)&mask;
+  }
+  return i;
+}
+
+void Vocabulary::grow() {
+  std::vector<uint32_t> oldslots(slots.size()*2, 0);
+  std::vector<uint32_t> oldtags(tags.size()*2, 0);
+  oldslots.swap(slots);
+  oldtags.swap(tags);
+  mask=slots.size()-1;
+  for(size_t j=0; j<oldslots.size(); j++) {
+    if(oldslots[j]) {
+      size_t i=hash_word(word(oldslots[j]-1))&mask;
+      while(slots[i]) {
+	i=(i+1)&mask;
+      }
+      slots[i]=oldslots[j];
+      tags[i]=oldtags[j];
+    }
+  }
+}
+
+int Vocabulary::add(boost::string_ref word) {
+  if(arena.size()+word.size()>UINT32_MAX) {
+    throw std::length_error("Vocabulary too large");
+  }
+  int id=size();
+  arena.insert(arena.end(), word.begin(), word.end());
+  offsets.push_back(arena.size());
+  vocabhash=hash_vocab_word(vocabhash, word);
+
+  //Keep the table at most half full
+  if(2*size()>slots.size()) {
+    grow();
+  }
+  uint64_t h=hash_word(word);
+  size_t i=find_slot(word, h);
+  slots[i]=id+1;
+  tags[i]=h>>32;
+  return id;
+}
+
+void Vocabulary::load(std::istream& in) {
+  std::string line;
+  while(getline(in, line)) {
+    add(line);
+  }
+}
+
+int Vocabulary::find(boost::string_ref word) const {
+  return (int)slots[find_slot(word, hash_word(word))]-1;
+}
+
+int Vocabulary::at(boost::string_ref word) const {
+  int id=find(word);
+  if(id<0) {
+    throw std::out_of_range("Word is not in the vocabulary");
+  }
+  return id;
+}
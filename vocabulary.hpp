@@ -0,0 +1,85 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Jeremy Salwen nor the name of any other
+ *    contributor may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef VOCABULARY_H
+#define VOCABULARY_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <istream>
+
+#include <boost/utility/string_ref.hpp>
+
+/*
+ * A vocabulary of words numbered in the order they were added.  The words
+ * are stored back to back in one arena and looked up through an open
+ * addressing hash table of ids, so lookups with a string_ref never
+ * allocate.  If a word is added twice, lookups find the later id.
+ */
+class Vocabulary {
+public:
+  Vocabulary();
+
+  //Adds the next word and returns its id
+  int add(boost::string_ref word);
+
+  //Adds every line of in
+  void load(std::istream& in);
+
+  //The id of word, or -1 if it is not in the vocabulary
+  int find(boost::string_ref word) const;
+
+  //The id of word.  Throws std::out_of_range if it is not in the vocabulary
+  int at(boost::string_ref word) const;
+
+  boost::string_ref word(size_t id) const {
+    return boost::string_ref(arena.data()+offsets[id], offsets[id+1]-offsets[id]);
+  }
+
+  size_t size() const {
+    return offsets.size()-1;
+  }
+
+  //Hash of the words in order, as recorded in indexed corpus files
+  uint64_t hash() const {
+    return vocabhash;
+  }
+
+private:
+  static uint64_t hash_word(boost::string_ref word);
+  size_t find_slot(boost::string_ref word, uint64_t h) const;
+  void grow();
+
+  std::vector<char> arena;
+  std::vector<uint32_t> offsets;
+  //Each slot holds an id+1, or 0 if empty, and the high bits of the word's hash
+  std::vector<uint32_t> slots;
+  std::vector<uint32_t> tags;
+  size_t mask;
+  uint64_t vocabhash;
+};
+
+#endif
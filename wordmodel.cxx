@@ -0,0 +1,168 @@
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. Neither the name of Jeremy Salwen nor the name of any other
+//    contributor may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+// OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+// OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+// ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#include "wordmodel.hpp"
+
+#include <fstream>
+#include <cstdlib>
+#include <cctype>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+//Rounds an offset up to the alignment of the idf and vector sections
+static uint64_t align_section(uint64_t offset) {
+  return (offset+63) & ~(uint64_t)63;
+}
+
+//Reads whitespace separated floats, regardless of how they are split into lines
+class FloatReader {
+public:
+  FloatReader(std::istream& in): in(in), p(line.c_str()) {
+  }
+
+  bool next(float& f) {
+    for(;;) {
+      while(std::isspace((unsigned char)*p)) {
+	p++;
+      }
+      if(*p) {
+	char* end;
+	f=std::strtof(p, &end);
+	if(end==p) {
+	  return false;
+	}
+	p=end;
+	return true;
+      }
+      if(!getline(in, line)) {
+	return false;
+      }
+      p=line.c_str();
+    }
+  }
+
+private:
+  std::istream& in;
+  std::string line;
+  const char* p;
+};
+
+WordModel::WordModel(): dim(0), origvects(new arma::fmat()) {
+}
+
+void WordModel::loadText(std::istream& vocabstream, std::istream& idfstream, std::istream& vectorstream, unsigned int vecdim) {
+  dim=vecdim;
+  vocab.load(vocabstream);
+
+  idfs.resize(vocab.size());
+  FloatReader idfreader(idfstream);
+  for(float& idf: idfs) {
+    if(!idfreader.next(idf)) {
+      throw std::runtime_error("idf file is shorter than the vocabulary");
+    }
+  }
+
+  //The vocabulary size is known, so the matrix is allocated once
+  origvects.reset(new arma::fmat(dim, vocab.size()));
+  FloatReader vectorreader(vectorstream);
+  float* v=origvects->memptr();
+  for(size_t i=0; i<(size_t)dim*vocab.size(); i++) {
+    if(!vectorreader.next(v[i])) {
+      throw std::runtime_error("vectors file is shorter than the vocabulary");
+    }
+  }
+}
+
+void WordModel::loadBinary(const std::string& path) {
+  if(boost::filesystem::file_size(path)<sizeof(WordModelHeader)) {
+    throw std::runtime_error(path+" is not a model file");
+  }
+  file.open(path);
+  const char* data=file.data();
+  WordModelHeader header;
+  std::copy(data, data+sizeof(header), (char*)&header);
+  if(!std::equal(WORD_MODEL_MAGIC, WORD_MODEL_MAGIC+8, header.magic) || header.version != WORD_MODEL_VERSION) {
+    throw std::runtime_error(path+" is not a model file");
+  }
+  if(header.vectoroffset+header.vocabsize*header.dim*sizeof(float) > file.size()) {
+    throw std::runtime_error(path+" is truncated");
+  }
+  dim=header.dim;
+
+  const uint64_t* ends=(const uint64_t*)(data+sizeof(header));
+  const char* words=(const char*)(ends+header.vocabsize);
+  uint64_t begin=0;
+  for(uint64_t i=0; i<header.vocabsize; i++) {
+    vocab.add(boost::string_ref(words+begin, ends[i]-begin));
+    begin=ends[i];
+  }
+  if(vocab.hash() != header.vocabhash) {
+    throw std::runtime_error(path+" has a corrupt vocabulary");
+  }
+
+  const float* idfdata=(const float*)(data+header.idfoffset);
+  idfs.assign(idfdata, idfdata+header.vocabsize);
+
+  //A read-only view of the mapped matrix, which is never written through
+  origvects.reset(new arma::fmat((float*)(data+header.vectoroffset), dim, header.vocabsize, false, true));
+}
+
+void WordModel::save(const std::string& path) const {
+  std::ofstream out(path.c_str(), std::ios::binary);
+  if(!out.good()) {
+    throw std::runtime_error("Could not open "+path);
+  }
+
+  WordModelHeader header;
+  std::copy(WORD_MODEL_MAGIC, WORD_MODEL_MAGIC+8, header.magic);
+  header.version=WORD_MODEL_VERSION;
+  header.dim=dim;
+  header.vocabsize=vocab.size();
+  header.vocabhash=vocab.hash();
+
+  std::vector<uint64_t> ends(vocab.size());
+  uint64_t end=0;
+  for(size_t i=0; i<vocab.size(); i++) {
+    end+=vocab.word(i).size();
+    ends[i]=end;
+  }
+  uint64_t wordsoffset=sizeof(header)+ends.size()*sizeof(uint64_t);
+  header.idfoffset=align_section(wordsoffset+end);
+  header.vectoroffset=align_section(header.idfoffset+idfs.size()*sizeof(float));
+
+  out.write((const char*)&header, sizeof(header));
+  out.write((const char*)ends.data(), ends.size()*sizeof(uint64_t));
+  for(size_t i=0; i<vocab.size(); i++) {
+    boost::string_ref word=vocab.word(i);
+    out.write(word.data(), word.size());
+  }
+  const char padding[64]={0};
+  out.write(padding, header.idfoffset-(wordsoffset+end));
+  out.write((const char*)idfs.data(), idfs.size()*sizeof(float));
+  out.write(padding, header.vectoroffset-(header.idfoffset+idfs.size()*sizeof(float)));
+  out.write((const char*)origvects->memptr(), origvects->n_elem*sizeof(float));
+  if(!out.good()) {
+    throw std::runtime_error("Error writing "+path);
+  }
+}
@@ -0,0 +1,95 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of Jeremy Salwen nor the name of any other
+ *    contributor may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY Jeremy Salwen AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL Jeremy Salwen OR ANY OTHER
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, 
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef WORD_MODEL_H
+#define WORD_MODEL_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <istream>
+#include <cstdint>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <armadillo>
+
+#include "vocabulary.hpp"
+
+/*
+ * Binary model files hold a WordModelHeader, the vocabulary as uint64
+ * end offsets followed by the concatenated words, the idf of every word,
+ * and the word vectors as a column-major float matrix.  The idf array and
+ * the matrix start on 64 byte boundaries, so the matrix can be used in
+ * place from a memory mapping.
+ */
+const char WORD_MODEL_MAGIC[8]={'C','M','V','M','O','D','E','L'};
+const uint32_t WORD_MODEL_VERSION=1;
+
+struct WordModelHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t dim;
+  uint64_t vocabsize;
+  uint64_t vocabhash;
+  uint64_t idfoffset;
+  uint64_t vectoroffset;
+};
+
+//The vocabulary, idf weights and word vectors the tools start from
+class WordModel {
+public:
+  WordModel();
+
+  /*
+   * Reads the text vocab, idf and vectors files.  Throws std::runtime_error
+   * if the idf or vectors file has fewer entries than the vocabulary.
+   */
+  void loadText(std::istream& vocabstream, std::istream& idfstream, std::istream& vectorstream, unsigned int vecdim);
+
+  /*
+   * Memory maps a binary model file.  The vectors are used directly from
+   * the mapping, so processes using the same model share them through the
+   * page cache.  Throws std::runtime_error if the file is not a model file.
+   */
+  void loadBinary(const std::string& path);
+
+  //Writes the model in the binary format
+  void save(const std::string& path) const;
+
+  const arma::fmat& vectors() const {
+    return *origvects;
+  }
+
+  Vocabulary vocab;
+  std::vector<float> idfs;
+  unsigned int dim;
+
+private:
+  std::unique_ptr<arma::fmat> origvects;
+  boost::iostreams::mapped_file_source file;
+};
+
+#endif